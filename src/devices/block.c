@@ -4,6 +4,10 @@
 #include <stdio.h>
 #include "devices/ide.h"
 #include "threads/malloc.h"
+#ifdef FILESYS
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
+#endif
 
 /* A block device. */
 struct block
@@ -176,6 +180,10 @@ block_print_stats (void)
                   block->read_cnt, block->write_cnt);
         }
     }
+#ifdef FILESYS
+  cache_print_stats ();
+  dcache_print_stats ();
+#endif
 }
 
 /* Registers a new block device with the given NAME.  If
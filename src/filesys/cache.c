@@ -0,0 +1,411 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Write-back buffer cache for the file system device.
+
+   Every sector read or written by the file system goes through
+   a fixed-size table of CACHE_SIZE entries.  A sector that is
+   already cached is served from memory; otherwise an entry is
+   chosen by the clock algorithm, written back if dirty, and
+   reused.  Dirty sectors reach the disk when they are evicted,
+   when a background flusher thread wakes up every
+   FLUSH_INTERVAL ticks, or when cache_flush() is called at
+   shutdown.  Once DIRTY_WATERMARK sectors are dirty, writers
+   flush the cache themselves before dirtying any more, which
+   bounds both the data lost in a crash and the time spent in
+   filesys_done().
+
+   Synchronization: CACHE_LOCK protects the mapping from sectors
+   to entries (the SECTOR, IN_USE, ACCESSED and PIN_CNT members)
+   as well as the clock hand.  Each entry's own LOCK protects its
+   DATA, VALID and DIRTY members.  A thread pins an entry under
+   CACHE_LOCK before waiting on the entry's lock, so that pinned
+   entries are never chosen for eviction, and it never acquires
+   CACHE_LOCK while holding an entry lock.
+
+   Sequential readers also queue the sectors they are about to
+   need with cache_read_ahead().  A kernel thread pulls sectors
+   off that queue and brings them into the cache in the
+   background, so the reader usually finds them already resident
+   instead of waiting on the disk. */
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Sector held by this entry. */
+    bool in_use;                        /* Does SECTOR mean anything? */
+    bool accessed;                      /* Used since the clock hand passed? */
+    int pin_cnt;                        /* Threads using or waiting on entry. */
+
+    struct lock lock;                   /* Protects the members below. */
+    bool valid;                         /* DATA holds SECTOR's contents? */
+    bool dirty;                         /* DATA newer than the disk? */
+    uint8_t *data;                      /* BLOCK_SECTOR_SIZE bytes. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;
+static size_t clock_hand;
+
+/* Read-ahead requests, a circular queue of sectors.
+   Requests that arrive while the queue is full are dropped. */
+#define READ_AHEAD_QUEUE_SIZE 32
+static block_sector_t read_ahead_queue[READ_AHEAD_QUEUE_SIZE];
+static size_t read_ahead_head;          /* Next request to serve. */
+static size_t read_ahead_cnt;           /* Number of queued requests. */
+static struct lock read_ahead_lock;     /* Protects the queue. */
+static struct condition read_ahead_cond; /* Signaled on new requests. */
+
+size_t cache_read_ahead_sectors = READ_AHEAD_DEFAULT;
+
+/* Ticks between runs of the flusher thread. */
+#define FLUSH_INTERVAL (5 * TIMER_FREQ)
+
+/* Number of dirty sectors at which writers are throttled. */
+#define DIRTY_WATERMARK (CACHE_SIZE / 2)
+
+static size_t cache_dirty_cnt;          /* Number of dirty entries. */
+static struct lock dirty_lock;          /* Protects CACHE_DIRTY_CNT and
+                                           CACHE_WRITEBACK_CNT. */
+
+/* Statistics. */
+static unsigned long long cache_hit_cnt;       /* Lookups served from memory. */
+static unsigned long long cache_miss_cnt;      /* Lookups that needed an entry. */
+static unsigned long long cache_writeback_cnt; /* Dirty sectors written out. */
+static unsigned long long cache_read_ahead_cnt; /* Sectors read ahead. */
+
+static struct cache_entry *cache_lookup (block_sector_t);
+static struct cache_entry *cache_get (block_sector_t, bool load);
+static void cache_put (struct cache_entry *);
+static void cache_write_back (struct cache_entry *);
+static thread_func read_ahead_daemon NO_RETURN;
+static thread_func flush_daemon NO_RETURN;
+
+/* Initializes the buffer cache. */
+void
+cache_init (void)
+{
+  size_t page_cnt = CACHE_SIZE * BLOCK_SECTOR_SIZE / PGSIZE;
+  uint8_t *buffers = palloc_get_multiple (PAL_ASSERT, page_cnt);
+  size_t i;
+
+  lock_init (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      e->in_use = false;
+      e->accessed = false;
+      e->pin_cnt = 0;
+      lock_init (&e->lock);
+      e->valid = false;
+      e->dirty = false;
+      e->data = buffers + i * BLOCK_SECTOR_SIZE;
+    }
+  clock_hand = 0;
+  cache_dirty_cnt = 0;
+  lock_init (&dirty_lock);
+
+  lock_init (&read_ahead_lock);
+  cond_init (&read_ahead_cond);
+  read_ahead_head = read_ahead_cnt = 0;
+  if (thread_create ("read-ahead", PRI_DEFAULT, read_ahead_daemon, NULL)
+      == TID_ERROR)
+    PANIC ("Failed to start read-ahead thread");
+  if (thread_create ("flusher", PRI_DEFAULT, flush_daemon, NULL)
+      == TID_ERROR)
+    PANIC ("Failed to start flusher thread");
+}
+
+/* Reads sector SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte offset OFS within sector
+   SECTOR into BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to sector SECTOR.
+   The data reaches the disk when the sector is evicted or the
+   cache is flushed.  May block to flush the cache first if too
+   much data is already dirty. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER to sector SECTOR, starting at
+   byte offset OFS within the sector.  The rest of the sector is
+   preserved, which requires reading it from disk if it is not
+   already cached, unless the whole sector is overwritten. */
+void
+cache_write_at (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  /* Throttle writers once the watermark is crossed.  Reading the
+     count without DIRTY_LOCK is fine: it is only a hint. */
+  if (cache_dirty_cnt >= DIRTY_WATERMARK)
+    cache_flush ();
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->valid = true;
+  if (!e->dirty)
+    {
+      e->dirty = true;
+      lock_acquire (&dirty_lock);
+      cache_dirty_cnt++;
+      lock_release (&dirty_lock);
+    }
+  cache_put (e);
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache.
+   Returns without waiting for the sector to be read. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&read_ahead_lock);
+  if (read_ahead_cnt < READ_AHEAD_QUEUE_SIZE)
+    {
+      size_t tail = (read_ahead_head + read_ahead_cnt) % READ_AHEAD_QUEUE_SIZE;
+      read_ahead_queue[tail] = sector;
+      read_ahead_cnt++;
+      cond_signal (&read_ahead_cond, &read_ahead_lock);
+    }
+  lock_release (&read_ahead_lock);
+}
+
+/* Writes every dirty cached sector back to disk, in ascending
+   sector order to keep disk head movement down. */
+void
+cache_flush (void)
+{
+  struct cache_entry *dirty[CACHE_SIZE];
+  size_t dirty_cnt = 0;
+  size_t i, j;
+
+  /* Pin the dirty entries, sorting them by sector as we go.
+     E->DIRTY is read without E->LOCK, so a sector dirtied
+     concurrently may be missed; it will be caught next time. */
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      if (!e->in_use || !e->dirty)
+        continue;
+
+      e->pin_cnt++;
+      for (j = dirty_cnt; j > 0 && dirty[j - 1]->sector > e->sector; j--)
+        dirty[j] = dirty[j - 1];
+      dirty[j] = e;
+      dirty_cnt++;
+    }
+  lock_release (&cache_lock);
+
+  for (i = 0; i < dirty_cnt; i++)
+    {
+      struct cache_entry *e = dirty[i];
+
+      lock_acquire (&e->lock);
+      if (e->dirty)
+        cache_write_back (e);
+      cache_put (e);
+    }
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Cache: %llu hits, %llu misses, %llu writebacks, "
+          "%llu read-aheads\n", cache_hit_cnt, cache_miss_cnt,
+          cache_writeback_cnt, cache_read_ahead_cnt);
+}
+
+/* Writes back the cache every FLUSH_INTERVAL ticks. */
+static void
+flush_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (FLUSH_INTERVAL);
+      cache_flush ();
+    }
+}
+
+/* Serves read-ahead requests queued by cache_read_ahead(). */
+static void
+read_ahead_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+      bool cached;
+
+      lock_acquire (&read_ahead_lock);
+      while (read_ahead_cnt == 0)
+        cond_wait (&read_ahead_cond, &read_ahead_lock);
+      sector = read_ahead_queue[read_ahead_head];
+      read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_QUEUE_SIZE;
+      read_ahead_cnt--;
+      lock_release (&read_ahead_lock);
+
+      lock_acquire (&cache_lock);
+      cached = cache_lookup (sector) != NULL;
+      lock_release (&cache_lock);
+
+      if (!cached)
+        {
+          cache_put (cache_get (sector, true));
+          cache_read_ahead_cnt++;
+        }
+    }
+}
+
+/* Returns the entry caching SECTOR, or a null pointer if there
+   is none.  Must be called with CACHE_LOCK held. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].in_use && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Chooses an entry to reuse with the clock algorithm, writing
+   it back first if it is dirty.  Returns a null pointer if every
+   entry is pinned.  Must be called with CACHE_LOCK held, which
+   also keeps other threads from reading the victim's sector from
+   disk before its write-back completes. */
+static struct cache_entry *
+cache_evict (void)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      if (!e->in_use)
+        return e;
+      if (e->pin_cnt > 0)
+        continue;
+      if (e->accessed)
+        {
+          e->accessed = false;
+          continue;
+        }
+
+      /* Unpinned, so no thread holds or waits on E->LOCK. */
+      if (e->dirty)
+        cache_write_back (e);
+      return e;
+    }
+  return NULL;
+}
+
+/* Returns the entry for SECTOR, pinned and with its lock held,
+   bringing the sector into the cache if necessary.  If LOAD is
+   true, the entry's data is read from disk if it is not valid
+   yet; otherwise the caller promises to overwrite all of it.
+   Release the entry with cache_put(). */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool load)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = cache_lookup (sector);
+      if (e != NULL)
+        {
+          cache_hit_cnt++;
+          break;
+        }
+
+      e = cache_evict ();
+      if (e != NULL)
+        {
+          cache_miss_cnt++;
+          e->sector = sector;
+          e->in_use = true;
+          e->valid = false;
+          break;
+        }
+
+      /* Every entry is in use by some thread.  Let them finish. */
+      lock_release (&cache_lock);
+      thread_yield ();
+      lock_acquire (&cache_lock);
+    }
+  e->pin_cnt++;
+  e->accessed = true;
+  lock_release (&cache_lock);
+
+  lock_acquire (&e->lock);
+  if (load && !e->valid)
+    {
+      block_read (fs_device, sector, e->data);
+      e->valid = true;
+    }
+  return e;
+}
+
+/* Writes dirty entry E to disk and marks it clean.  The caller
+   must either hold E->LOCK or hold CACHE_LOCK with E unpinned. */
+static void
+cache_write_back (struct cache_entry *e)
+{
+  ASSERT (e->dirty);
+
+  block_write (fs_device, e->sector, e->data);
+  e->dirty = false;
+
+  lock_acquire (&dirty_lock);
+  cache_dirty_cnt--;
+  cache_writeback_cnt++;
+  lock_release (&dirty_lock);
+}
+
+/* Releases entry E obtained from cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  ASSERT (e->pin_cnt > 0);
+  e->pin_cnt--;
+  lock_release (&cache_lock);
+}
@@ -0,0 +1,159 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Remembers the result of recent directory lookups, keyed by
+   the inode sector of the directory searched and the name
+   looked up, so that walking the same path again does not read
+   the directories along it.  Lookups that found nothing are
+   cached too, as entries whose SECTOR is 0: no directory entry
+   can refer to sector 0, which holds the free map's inode.
+
+   The directory code keeps the cache current by calling
+   dcache_insert() whenever it adds or removes a name.  When
+   all DCACHE_SIZE entries are in use, the least recently used
+   one is replaced.  DCACHE_LOCK protects everything here. */
+
+/* A cached name. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in DENTRIES. */
+    struct list_elem lru_elem;          /* Element in LRU_LIST. */
+    block_sector_t parent;              /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Name within PARENT. */
+    block_sector_t sector;              /* NAME's inode sector, or 0. */
+  };
+
+static struct dentry dentry_pool[DCACHE_SIZE];
+static size_t dentry_used;              /* Entries of DENTRY_POOL in use. */
+static struct hash dentries;            /* Entries in use, by key. */
+static struct list lru_list;            /* Entries in use, LRU first. */
+static struct lock dcache_lock;
+
+/* Statistics. */
+static unsigned long long dcache_hit_cnt;      /* Names found cached. */
+static unsigned long long dcache_miss_cnt;     /* Names not cached. */
+
+/* Returns a hash value for dentry E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+  if (a->parent != b->parent)
+    return a->parent < b->parent;
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  hash_init (&dentries, dentry_hash, dentry_less, NULL);
+  list_init (&lru_list);
+  lock_init (&dcache_lock);
+}
+
+/* Returns the cached entry for NAME in the directory whose inode
+   is in PARENT, or a null pointer if there is none.
+   DCACHE_LOCK must be held. */
+static struct dentry *
+find (block_sector_t parent, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in the directory whose inode is in PARENT.
+   Returns false if the answer is not cached.  Otherwise returns
+   true and sets *SECTOR to NAME's inode sector, or to 0 if the
+   directory has no entry named NAME. */
+bool
+dcache_lookup (block_sector_t parent, const char *name,
+               block_sector_t *sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return false;
+
+  lock_acquire (&dcache_lock);
+  d = find (parent, name);
+  if (d != NULL)
+    {
+      *sector = d->sector;
+      list_remove (&d->lru_elem);
+      list_push_back (&lru_list, &d->lru_elem);
+      dcache_hit_cnt++;
+    }
+  else
+    dcache_miss_cnt++;
+  lock_release (&dcache_lock);
+
+  return d != NULL;
+}
+
+/* Records that NAME in the directory whose inode is in PARENT
+   refers to the inode in SECTOR, or, if SECTOR is 0, that the
+   directory has no entry named NAME. */
+void
+dcache_insert (block_sector_t parent, const char *name,
+               block_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (parent, name);
+  if (d != NULL)
+    list_remove (&d->lru_elem);
+  else
+    {
+      if (dentry_used < DCACHE_SIZE)
+        d = &dentry_pool[dentry_used++];
+      else
+        {
+          /* Replace the least recently used entry. */
+          d = list_entry (list_pop_front (&lru_list),
+                          struct dentry, lru_elem);
+          hash_delete (&dentries, &d->hash_elem);
+        }
+      d->parent = parent;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+    }
+  d->sector = sector;
+  list_push_back (&lru_list, &d->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Prints directory entry cache statistics. */
+void
+dcache_print_stats (void)
+{
+  printf ("Dentry cache: %llu hits, %llu misses\n",
+          dcache_hit_cnt, dcache_miss_cnt);
+}
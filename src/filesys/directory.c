@@ -1,16 +1,38 @@
 #include "filesys/directory.h"
+#include <hash.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* A directory is a hash table kept in its inode's data.
+   Sector 0 of the file holds a struct dir_header and sectors 1
+   through BUCKET_CNT each hold one bucket of entries.  A name
+   lives in the bucket picked by the low bits of its hash, so a
+   lookup reads one bucket however large the directory grows.
+   When a name's bucket is full, the table doubles, splitting
+   each bucket in two.
+
+   Each operation that reads or changes entries holds the
+   directory inode's lock (see inode_lock()) throughout, so that,
+   for example, two threads cannot both add the same name.  An
+   operation that needs a subdirectory's lock as well takes the
+   parent's first. */
+
+/* Identifies a directory header. */
+#define DIR_MAGIC 0x44495248
+
+/* Largest number of buckets a directory may have. */
+#define MAX_BUCKET_CNT 4096
+
 /* A directory. */
 struct dir 
   {
     struct inode *inode;                /* Backing store. */
-    off_t pos;                          /* Current position. */
+    off_t pos;                          /* Current entry, for readdir. */
   };
 
 /* A single directory entry. */
@@ -21,21 +43,116 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* Number of entries in one bucket. */
+#define BUCKET_ENTRY_CNT (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* A bucket of entries, one sector of the directory file. */
+struct dir_bucket
+  {
+    struct dir_entry entries[BUCKET_ENTRY_CNT];
+  };
+
+/* Directory header, at the start of the directory file. */
+struct dir_header
+  {
+    unsigned magic;                     /* Magic number. */
+    uint32_t bucket_cnt;                /* Number of buckets, a power of 2. */
+    block_sector_t parent;              /* Inode sector of "..". */
+  };
+
+/* Returns the byte offset of entry IDX in bucket BUCKET. */
+static off_t
+entry_ofs (size_t bucket, size_t idx)
+{
+  return ((off_t) (bucket + 1) * BLOCK_SECTOR_SIZE
+          + idx * sizeof (struct dir_entry));
+}
+
+/* Returns the bucket that NAME belongs in, in a directory with
+   BUCKET_CNT buckets. */
+static size_t
+name_to_bucket (const char *name, size_t bucket_cnt)
+{
+  return hash_string (name) & (bucket_cnt - 1);
+}
+
+/* Returns true if NAME is "." or "..", which are not stored as
+   entries. */
+static bool
+is_dot_name (const char *name)
+{
+  return !strcmp (name, ".") || !strcmp (name, "..");
+}
+
+/* Reads DIR's header into *HDR.
+   Returns true if successful, false if DIR is damaged. */
+static bool
+read_header (const struct dir *dir, struct dir_header *hdr)
+{
+  return (inode_read_at (dir->inode, hdr, sizeof *hdr, 0) == sizeof *hdr
+          && hdr->magic == DIR_MAGIC);
+}
+
+/* Reads entry IDX of BUCKET in DIR into *E.
+   Entries past the end of the file read as free. */
+static void
+read_entry (const struct dir *dir, size_t bucket, size_t idx,
+            struct dir_entry *e)
+{
+  if (inode_read_at (dir->inode, e, sizeof *e, entry_ofs (bucket, idx))
+      != sizeof *e)
+    memset (e, 0, sizeof *e);
+}
+
+/* Writes *E to entry IDX of BUCKET in DIR.
+   Returns true if successful, false on failure. */
+static bool
+write_entry (struct dir *dir, size_t bucket, size_t idx,
+             const struct dir_entry *e)
+{
+  return (inode_write_at (dir->inode, e, sizeof *e, entry_ofs (bucket, idx))
+          == sizeof *e);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, whose parent directory is in sector PARENT.
+   Returns true if successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, block_sector_t parent, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir_header hdr;
+  struct inode *inode;
+  bool success = false;
+
+  hdr.magic = DIR_MAGIC;
+  hdr.parent = parent;
+  hdr.bucket_cnt = 1;
+  while (hdr.bucket_cnt * BUCKET_ENTRY_CNT < entry_cnt
+         && hdr.bucket_cnt < MAX_BUCKET_CNT)
+    hdr.bucket_cnt *= 2;
+
+  /* Buckets are holes until an entry is written to them. */
+  if (!inode_create (sector, (hdr.bucket_cnt + 1) * BLOCK_SECTOR_SIZE, true))
+    return false;
+  inode = inode_open (sector);
+  if (inode != NULL)
+    {
+      success = inode_write_at (inode, &hdr, sizeof hdr, 0) == sizeof hdr;
+      if (!success)
+        inode_remove (inode);
+      inode_close (inode);
+    }
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
-   it takes ownership.  Returns a null pointer on failure. */
+   it takes ownership.  Returns a null pointer on failure,
+   including if INODE is not a directory. */
 struct dir *
 dir_open (struct inode *inode) 
 {
   struct dir *dir = calloc (1, sizeof *dir);
-  if (inode != NULL && dir != NULL)
+  if (inode != NULL && dir != NULL && inode_is_dir (inode))
     {
       dir->inode = inode;
       dir->pos = 0;
@@ -45,7 +162,7 @@ dir_open (struct inode *inode)
     {
       inode_close (inode);
       free (dir);
-      return NULL; 
+      return NULL;
     }
 }
 
@@ -85,29 +202,38 @@ dir_get_inode (struct dir *dir)
 
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   if EP is non-null, and sets *BUCKETP and *IDXP to its position
+   if they are non-null.
+   otherwise, returns false and ignores EP, BUCKETP and IDXP. */
 static bool
 lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+        struct dir_entry *ep, size_t *bucketp, size_t *idxp)
 {
+  struct dir_header hdr;
   struct dir_entry e;
-  size_t ofs;
-  
+  size_t bucket, idx;
+
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
+  if (!read_header (dir, &hdr))
+    return false;
+
+  bucket = name_to_bucket (name, hdr.bucket_cnt);
+  for (idx = 0; idx < BUCKET_ENTRY_CNT; idx++)
+    {
+      read_entry (dir, bucket, idx, &e);
+      if (e.in_use && !strcmp (name, e.name))
+        {
+          if (ep != NULL)
+            *ep = e;
+          if (bucketp != NULL)
+            *bucketp = bucket;
+          if (idxp != NULL)
+            *idxp = idx;
+          return true;
+        }
+    }
   return false;
 }
 
@@ -117,83 +243,207 @@ lookup (const struct dir *dir, const char *name,
    a null pointer.  The caller must close *INODE. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
-            struct inode **inode) 
+            struct inode **inode)
 {
+  block_sector_t parent, sector;
+  struct dir_header hdr;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  parent = inode_get_inumber (dir->inode);
+  if (!strcmp (name, "."))
+    *inode = inode_reopen (dir->inode);
+  else if (!strcmp (name, ".."))
+    *inode = read_header (dir, &hdr) ? inode_open (hdr.parent) : NULL;
+  else if (dcache_lookup (parent, name, &sector))
+    *inode = sector != 0 ? inode_open (sector) : NULL;
   else
-    *inode = NULL;
+    {
+      inode_lock (dir->inode);
+      sector = lookup (dir, name, &e, NULL, NULL) ? e.inode_sector : 0;
+      dcache_insert (parent, name, sector);
+      inode_unlock (dir->inode);
+      *inode = sector != 0 ? inode_open (sector) : NULL;
+    }
 
   return *inode != NULL;
 }
 
+/* Doubles the number of buckets in DIR, whose header is *HDR.
+   Each entry in bucket B whose hash has the new bit set moves to
+   bucket B + the old bucket count.  The new buckets are written
+   in full before the header changes, so a failure part way
+   leaves DIR as it was.
+   Returns true if successful, false on failure. */
+static bool
+expand (struct dir *dir, struct dir_header *hdr)
+{
+  size_t old_cnt = hdr->bucket_cnt;
+  struct dir_bucket *old = NULL, *new = NULL;
+  bool success = false;
+  size_t bucket, idx;
+
+  if (old_cnt >= MAX_BUCKET_CNT)
+    return false;
+  old = malloc (sizeof *old);
+  new = malloc (sizeof *new);
+  if (old == NULL || new == NULL)
+    goto done;
+
+  /* Fill the new buckets. */
+  for (bucket = 0; bucket < old_cnt; bucket++)
+    {
+      size_t new_idx = 0;
+
+      for (idx = 0; idx < BUCKET_ENTRY_CNT; idx++)
+        read_entry (dir, bucket, idx, &old->entries[idx]);
+      memset (new, 0, sizeof *new);
+      for (idx = 0; idx < BUCKET_ENTRY_CNT; idx++)
+        if (old->entries[idx].in_use
+            && name_to_bucket (old->entries[idx].name, old_cnt * 2) != bucket)
+          new->entries[new_idx++] = old->entries[idx];
+      if (inode_write_at (dir->inode, new, sizeof *new,
+                          entry_ofs (bucket + old_cnt, 0)) != sizeof *new)
+        goto done;
+    }
+
+  /* Switch over. */
+  hdr->bucket_cnt = old_cnt * 2;
+  if (inode_write_at (dir->inode, hdr, sizeof *hdr, 0) != sizeof *hdr)
+    {
+      hdr->bucket_cnt = old_cnt;
+      goto done;
+    }
+
+  /* Drop the entries that moved from the old buckets. */
+  for (bucket = 0; bucket < old_cnt; bucket++)
+    for (idx = 0; idx < BUCKET_ENTRY_CNT; idx++)
+      {
+        struct dir_entry e;
+
+        read_entry (dir, bucket, idx, &e);
+        if (e.in_use && name_to_bucket (e.name, old_cnt * 2) != bucket)
+          {
+            e.in_use = false;
+            write_entry (dir, bucket, idx, &e);
+          }
+      }
+  success = true;
+
+ done:
+  free (old);
+  free (new);
+  return success;
+}
+
+/* Adds NAME to DIR as for dir_add().
+   DIR's inode must be locked. */
+static bool
+add (struct dir *dir, const char *name, block_sector_t inode_sector)
+{
+  struct dir_header hdr;
+  struct dir_entry e;
+
+  /* Check that DIR can still gain entries and NAME is not in use. */
+  if (inode_is_removed (dir->inode) || lookup (dir, name, NULL, NULL, NULL))
+    return false;
+
+  if (!read_header (dir, &hdr))
+    return false;
+  for (;;)
+    {
+      size_t bucket = name_to_bucket (name, hdr.bucket_cnt);
+      size_t idx;
+
+      /* Write the first free slot in NAME's bucket. */
+      for (idx = 0; idx < BUCKET_ENTRY_CNT; idx++)
+        {
+          read_entry (dir, bucket, idx, &e);
+          if (!e.in_use)
+            {
+              e.in_use = true;
+              strlcpy (e.name, name, sizeof e.name);
+              e.inode_sector = inode_sector;
+              if (!write_entry (dir, bucket, idx, &e))
+                return false;
+              dcache_insert (inode_get_inumber (dir->inode), name,
+                             inode_sector);
+              return true;
+            }
+        }
+
+      /* The bucket is full. */
+      if (!expand (dir, &hdr))
+        return false;
+    }
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long), if DIR has been
+   removed, or a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
-  struct dir_entry e;
-  off_t ofs;
-  bool success = false;
+  bool success;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   /* Check NAME for validity. */
-  if (*name == '\0' || strlen (name) > NAME_MAX)
+  if (*name == '\0' || strlen (name) > NAME_MAX || is_dot_name (name))
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
-    goto done;
+  inode_lock (dir->inode);
+  success = add (dir, name, inode_sector);
+  inode_unlock (dir->inode);
+  return success;
+}
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
-
-  /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+/* Returns true if DIR has no entries. */
+static bool
+is_empty (const struct dir *dir)
+{
+  struct dir_header hdr;
+  struct dir_entry e;
+  size_t bucket, idx;
 
- done:
-  return success;
+  if (!read_header (dir, &hdr))
+    return false;
+  for (bucket = 0; bucket < hdr.bucket_cnt; bucket++)
+    for (idx = 0; idx < BUCKET_ENTRY_CNT; idx++)
+      {
+        read_entry (dir, bucket, idx, &e);
+        if (e.in_use)
+          return false;
+      }
+  return true;
 }
 
 /* Removes any entry for NAME in DIR.
    Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   which occurs only if there is no file with the given NAME
+   or if NAME is a directory that is not empty. */
 bool
-dir_remove (struct dir *dir, const char *name) 
+dir_remove (struct dir *dir, const char *name)
 {
   struct dir_entry e;
   struct inode *inode = NULL;
+  bool child_locked = false;
   bool success = false;
-  off_t ofs;
+  size_t bucket, idx;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  inode_lock (dir->inode);
+
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  if (!lookup (dir, name, &e, &bucket, &idx))
     goto done;
 
   /* Open inode. */
@@ -201,36 +451,61 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
+  /* Only empty directories may be removed.  Holding the
+     directory's lock until it is marked removed keeps entries
+     from being added to it in the meantime. */
+  if (inode_is_dir (inode))
+    {
+      struct dir child;
+
+      inode_lock (inode);
+      child_locked = true;
+      child.inode = inode;
+      if (!is_empty (&child))
+        goto done;
+    }
+
   /* Erase directory entry. */
   e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
+  if (!write_entry (dir, bucket, idx, &e))
     goto done;
+  dcache_insert (inode_get_inumber (dir->inode), name, 0);
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  if (child_locked)
+    inode_unlock (inode);
+  inode_unlock (dir->inode);
   inode_close (inode);
   return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.  "." and ".." are not returned. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
+  struct dir_header hdr;
   struct dir_entry e;
+  bool found = false;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
-    {
-      dir->pos += sizeof e;
-      if (e.in_use)
-        {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
-    }
-  return false;
+  inode_lock (dir->inode);
+  if (read_header (dir, &hdr))
+    while (!found && (size_t) dir->pos < hdr.bucket_cnt * BUCKET_ENTRY_CNT)
+      {
+        read_entry (dir, dir->pos / BUCKET_ENTRY_CNT,
+                    dir->pos % BUCKET_ENTRY_CNT, &e);
+        dir->pos++;
+        if (e.in_use)
+          {
+            strlcpy (name, e.name, NAME_MAX + 1);
+            found = true;
+          }
+      }
+  inode_unlock (dir->inode);
+  return found;
 }
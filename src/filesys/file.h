@@ -10,6 +10,7 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t read_end;             /* Position where the last read ended. */
   };
 
 struct inode;
@@ -2,10 +2,13 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
@@ -21,7 +24,9 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  dcache_init ();
   free_map_init ();
 
   if (format) 
@@ -36,8 +41,104 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  cache_flush ();
 }
 
+/* Opens the directory that holds the last component of PATH
+   and copies that component into NAME.  Relative paths start
+   from the current thread's working directory.  A path that
+   names a directory itself, such as "/" or "a/..", yields NAME
+   "." or "..".
+   Returns the directory, which the caller must close, or a null
+   pointer if PATH is empty, a component is too long, or a
+   directory along the way does not exist. */
+static struct dir *
+resolve_path (const char *path, char name[NAME_MAX + 1])
+{
+  struct thread *t = thread_current ();
+  struct dir *dir;
+  bool pending = false;
+
+  if (*path == '\0')
+    return NULL;
+  if (*path == '/' || t->cwd == NULL)
+    dir = dir_open_root ();
+  else
+    dir = dir_reopen (t->cwd);
+  strlcpy (name, ".", NAME_MAX + 1);
+
+  while (dir != NULL)
+    {
+      size_t len;
+
+      while (*path == '/')
+        path++;
+      if (*path == '\0')
+        break;
+      len = strcspn (path, "/");
+      if (len > NAME_MAX)
+        {
+          dir_close (dir);
+          return NULL;
+        }
+
+      /* The previous component must be a directory. */
+      if (pending)
+        {
+          struct inode *inode;
+          struct dir *next = NULL;
+
+          if (dir_lookup (dir, name, &inode))
+            next = dir_open (inode);
+          dir_close (dir);
+          dir = next;
+        }
+
+      memcpy (name, path, len);
+      name[len] = '\0';
+      path += len;
+      pending = true;
+    }
+  return dir;
+}
+
+/* Creates a file, or a directory if IS_DIR is true, at PATH
+   with the given INITIAL_SIZE.
+   Returns true if successful, false otherwise. */
+static bool
+create (const char *path, off_t initial_size, bool is_dir)
+{
+  char name[NAME_MAX + 1];
+  block_sector_t inode_sector = 0;
+  struct dir *dir = resolve_path (path, name);
+  bool created = false;
+  bool success;
+
+  /* Place the new inode near its directory. */
+  if (dir != NULL
+      && free_map_allocate_near (1, inode_get_inumber (dir_get_inode (dir)),
+                                 &inode_sector))
+    created = (is_dir
+               ? dir_create (inode_sector,
+                             inode_get_inumber (dir_get_inode (dir)), 0)
+               : inode_create (inode_sector, initial_size, false));
+  success = created && dir_add (dir, name, inode_sector);
+  if (!success && inode_sector != 0) 
+    {
+      struct inode *inode = created ? inode_open (inode_sector) : NULL;
+      if (inode != NULL)
+        {
+          inode_remove (inode);
+          inode_close (inode);
+        }
+      else
+        free_map_release (inode_sector, 1);
+    }
+  dir_close (dir);
+
+  return success;
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
@@ -45,20 +146,20 @@ filesys_done (void)
 bool
 filesys_create (const char *name, off_t initial_size) 
 {
-  block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
-  if (!success && inode_sector != 0) 
-    free_map_release (inode_sector, 1);
-  dir_close (dir);
+  return create (name, initial_size, false);
+}
 
-  return success;
+/* Creates an empty directory named NAME.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists,
+   or if internal memory allocation fails. */
+bool
+filesys_mkdir (const char *name)
+{
+  return create (name, 0, true);
 }
 
-/* Opens the file with the given NAME.
+/* Opens the file or directory with the given NAME.
    Returns the new file if successful or a null pointer
    otherwise.
    Fails if no file named NAME exists,
@@ -66,37 +167,63 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
+  char last[NAME_MAX + 1];
+  struct dir *dir = resolve_path (name, last);
   struct inode *inode = NULL;
 
   if (dir != NULL)
-    dir_lookup (dir, name, &inode);
+    dir_lookup (dir, last, &inode);
   dir_close (dir);
 
   return file_open (inode);
 }
 
-/* Deletes the file named NAME.
+/* Deletes the file or empty directory named NAME.
    Returns true if successful, false on failure.
    Fails if no file named NAME exists,
    or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char last[NAME_MAX + 1];
+  struct dir *dir = resolve_path (name, last);
+  bool success = dir != NULL && dir_remove (dir, last);
   dir_close (dir); 
 
   return success;
 }
-
+
+/* Makes the directory named NAME the current thread's working
+   directory.
+   Returns true if successful, false on failure. */
+bool
+filesys_chdir (const char *name)
+{
+  struct thread *t = thread_current ();
+  char last[NAME_MAX + 1];
+  struct dir *dir = resolve_path (name, last);
+  struct inode *inode = NULL;
+  struct dir *cwd;
+
+  if (dir != NULL)
+    dir_lookup (dir, last, &inode);
+  dir_close (dir);
+
+  cwd = dir_open (inode);
+  if (cwd == NULL)
+    return false;
+  dir_close (t->cwd);
+  t->cwd = cwd;
+  return true;
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
   free_map_close ();
   printf ("done.\n");
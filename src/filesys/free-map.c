@@ -1,12 +1,50 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Protects FREE_MAP and
+                                        GROUP_FREE_CNT. */
+
+/* The disk is divided into allocation groups of GROUP_SECTORS
+   consecutive sectors, and the number of free sectors in each is
+   kept up to date, so that searches can skip full groups without
+   looking at their bits.
+
+   Small requests are placed first-fit, starting from a hint
+   sector that callers set to something the new sectors belong
+   with, such as the directory that will hold a new inode or the
+   end of the file being extended.  Requests of BEST_FIT_MIN or
+   more sectors go in the smallest free run that holds them,
+   which keeps large runs intact for large files. */
+#define GROUP_SECTORS 512
+#define BEST_FIT_MIN 8
+
+static size_t group_cnt;             /* Number of groups. */
+static size_t *group_free_cnt;       /* Free sectors in each group. */
+
+/* Recomputes GROUP_FREE_CNT from the free map. */
+static void
+count_free (void)
+{
+  size_t sector_cnt = bitmap_size (free_map);
+  size_t group;
+
+  for (group = 0; group < group_cnt; group++)
+    {
+      size_t start = group * GROUP_SECTORS;
+      size_t cnt = sector_cnt - start < GROUP_SECTORS
+                   ? sector_cnt - start : GROUP_SECTORS;
+      group_free_cnt[group] = bitmap_count (free_map, start, cnt, false);
+    }
+}
 
 /* Initializes the free map. */
 void
@@ -17,36 +55,223 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  lock_init (&free_map_lock);
+
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  group_free_cnt = malloc (group_cnt * sizeof *group_free_cnt);
+  if (group_free_cnt == NULL)
+    PANIC ("allocation group creation failed");
+  count_free ();
 }
 
-/* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+/* Marks the CNT sectors starting at SECTOR as used if USED is
+   true, or as free otherwise.  The sectors must all be in the
+   opposite state now. */
+static void
+mark (block_sector_t sector, size_t cnt, bool used)
+{
+  ASSERT (used ? bitmap_none (free_map, sector, cnt)
+               : bitmap_all (free_map, sector, cnt));
+
+  bitmap_set_multiple (free_map, sector, cnt, used);
+  while (cnt > 0)
+    {
+      size_t group = sector / GROUP_SECTORS;
+      size_t group_left = (group + 1) * GROUP_SECTORS - sector;
+      size_t n = cnt < group_left ? cnt : group_left;
+
+      if (used)
+        group_free_cnt[group] -= n;
+      else
+        group_free_cnt[group] += n;
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Writes the part of the free map that holds the CNT sectors
+   starting at SECTOR to disk, if the free map file is open.
+   Returns true if successful, false on failure. */
+static bool
+store (block_sector_t sector, size_t cnt)
+{
+  return (free_map_file == NULL
+          || bitmap_write_range (free_map, free_map_file, sector, cnt));
+}
+
+/* Returns the first sector in [LO, HI) that starts a run of CNT
+   free sectors, or BITMAP_ERROR if there is none.  The run may
+   extend past HI. */
+static block_sector_t
+scan (size_t cnt, block_sector_t lo, block_sector_t hi)
+{
+  size_t sector_cnt = bitmap_size (free_map);
+  block_sector_t sector;
+
+  for (sector = lo; sector < hi && sector + cnt <= sector_cnt; sector++)
+    if (bitmap_none (free_map, sector, cnt))
+      return sector;
+  return BITMAP_ERROR;
+}
+
+/* Returns the first run of CNT free sectors at or after HINT,
+   wrapping around to the start of the disk, or BITMAP_ERROR if
+   there is none. */
+static block_sector_t
+find_first_fit (size_t cnt, block_sector_t hint)
+{
+  size_t sector_cnt = bitmap_size (free_map);
+  size_t first = hint / GROUP_SECTORS;
+  size_t i;
+
+  /* Visit HINT's group from HINT onward first and the part of it
+     before HINT last. */
+  for (i = 0; i <= group_cnt; i++)
+    {
+      size_t group = (first + i) % group_cnt;
+      block_sector_t lo = group * GROUP_SECTORS;
+      block_sector_t hi = lo + GROUP_SECTORS < sector_cnt
+                          ? lo + GROUP_SECTORS : sector_cnt;
+      block_sector_t sector;
+
+      if (group_free_cnt[group] == 0)
+        continue;
+      if (i == 0)
+        lo = hint;
+      else if (i == group_cnt)
+        hi = hint;
+
+      sector = scan (cnt, lo, hi);
+      if (sector != BITMAP_ERROR)
+        return sector;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Returns the start of the shortest run of free sectors that
+   holds CNT of them, preferring the run closest to HINT among
+   equally short ones, or BITMAP_ERROR if there is none. */
+static block_sector_t
+find_best_fit (size_t cnt, block_sector_t hint)
+{
+  size_t sector_cnt = bitmap_size (free_map);
+  block_sector_t best = BITMAP_ERROR;
+  size_t best_len = 0, best_dist = 0;
+  block_sector_t sector = 0;
+
+  while (sector < sector_cnt)
+    {
+      block_sector_t start;
+      size_t len, dist;
+
+      if (group_free_cnt[sector / GROUP_SECTORS] == 0)
+        {
+          sector = ROUND_DOWN (sector, GROUP_SECTORS) + GROUP_SECTORS;
+          continue;
+        }
+      if (bitmap_test (free_map, sector))
+        {
+          sector++;
+          continue;
+        }
+
+      start = sector;
+      while (sector < sector_cnt && !bitmap_test (free_map, sector))
+        sector++;
+      len = sector - start;
+      if (len < cnt)
+        continue;
+
+      dist = start > hint ? start - hint : hint - start;
+      if (best == BITMAP_ERROR || len < best_len
+          || (len == best_len && dist < best_dist))
+        {
+          best = start;
+          best_len = len;
+          best_dist = dist;
+          if (len == cnt && dist == 0)
+            break;
+        }
+    }
+  return best;
+}
+
+/* Allocates CNT consecutive sectors from the free map, as close
+   to sector HINT as it can, and stores the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available or if the free_map file could not be
+   written. */
 bool
-free_map_allocate (size_t cnt, block_sector_t *sectorp)
+free_map_allocate_near (size_t cnt, block_sector_t hint,
+                        block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  if (hint >= bitmap_size (free_map))
+    hint = 0;
+  if (cnt >= BEST_FIT_MIN)
+    sector = find_best_fit (cnt, hint);
+  else
+    sector = find_first_fit (cnt, hint);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      mark (sector, cnt, true);
+      if (!store (sector, cnt))
+        {
+          mark (sector, cnt, false);
+          sector = BITMAP_ERROR;
+        }
     }
+  lock_release (&free_map_lock);
+
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates CNT consecutive sectors from the free map and stores
+   the first into *SECTORP.
+   Returns true if successful, false if not enough consecutive
+   sectors were available or if the free_map file could not be
+   written. */
+bool
+free_map_allocate (size_t cnt, block_sector_t *sectorp)
+{
+  return free_map_allocate_near (cnt, 0, sectorp);
+}
+
+/* Allocates the CNT sectors starting at SECTOR, if all of them
+   exist and are free.
+   Returns true if successful, false if any of the sectors is
+   unavailable or if the free_map file could not be written. */
+bool
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  bool success = false;
+
+  lock_acquire (&free_map_lock);
+  if (sector < bitmap_size (free_map)
+      && cnt <= bitmap_size (free_map) - sector
+      && bitmap_none (free_map, sector, cnt))
+    {
+      mark (sector, cnt, true);
+      success = store (sector, cnt);
+      if (!success)
+        mark (sector, cnt, false);
+    }
+  lock_release (&free_map_lock);
+  return success;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
-  ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  lock_acquire (&free_map_lock);
+  mark (sector, cnt, false);
+  store (sector, cnt);
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,6 +283,7 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  count_free ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -72,14 +298,22 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
+  struct file *file;
+
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  Writing it allocates the file's own
+     sectors, so FREE_MAP_FILE stays null during the first write
+     to keep free_map_allocate() from writing the bitmap
+     recursively.  The second write records those sectors. */
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
+  if (!bitmap_write (free_map, file))
+    PANIC ("can't write free map");
+  free_map_file = file;
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
 }
@@ -1,106 +1,406 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A run of LENGTH consecutive disk sectors starting at START
+   that holds file sectors OFS through OFS + LENGTH - 1. */
+struct extent
+  {
+    uint32_t ofs;                       /* First file sector. */
+    block_sector_t start;               /* First disk sector. */
+    uint32_t length;                    /* Number of sectors. */
+  };
+
+/* Most sectors allocated to a file at once. */
+#define MAX_RUN 32
+
+/* Number of extents stored in the inode itself and in each
+   overflow extent block. */
+#define INLINE_EXTENT_CNT 41
+#define BLOCK_EXTENT_CNT 42
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   A file's data is described by EXTENT_CNT extents sorted by
+   file offset.  The first INLINE_EXTENT_CNT live in the inode and
+   the rest in a chain of extent blocks starting at NEXT.  File
+   sectors not covered by any extent have not been allocated yet:
+   they read as zeros and get a sector the first time they are
+   written. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t extent_cnt;                /* Number of extents. */
+    block_sector_t next;                /* First extent block, or 0. */
+    struct extent extents[INLINE_EXTENT_CNT]; /* First extents. */
+    uint32_t is_dir;                    /* 1 for a directory, 0 for a file. */
   };
 
-/* Returns the number of sectors to allocate for an inode SIZE
-   bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size)
-{
-  return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
-}
+/* Overflow extent block.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_block
+  {
+    block_sector_t next;                /* Next extent block, or 0. */
+    struct extent extents[BLOCK_EXTENT_CNT]; /* Extents. */
+    uint32_t unused[1];                 /* Not used. */
+  };
 
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    struct lock lock;                   /* See inode_lock(). */
+
+    /* RWLOCK protects the members below.  Reading the file takes
+       it for reading, writing the file takes it for writing. */
+    struct rwlock rwlock;
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct inode_disk data;             /* Inode content. */
+    struct extent *extents;             /* All DATA.EXTENT_CNT extents. */
+    size_t extent_cap;                  /* Number of elements in EXTENTS. */
+    block_sector_t *blocks;             /* Sectors of the extent blocks. */
+    size_t block_cnt;                   /* Number of extent blocks. */
   };
 
+/* Returns the number of extent blocks needed to hold EXTENT_CNT
+   extents. */
+static inline size_t
+extents_to_blocks (size_t extent_cnt)
+{
+  return (extent_cnt <= INLINE_EXTENT_CNT ? 0
+          : DIV_ROUND_UP (extent_cnt - INLINE_EXTENT_CNT, BLOCK_EXTENT_CNT));
+}
+
+/* Makes room for CNT extents in INODE's EXTENTS array and for
+   the EXTENT_BLOCKS sectors it takes to hold them on disk.
+   Allocates the extent blocks themselves only if ALLOCATE is
+   true.  Returns false if memory or disk space runs out. */
+static bool
+extents_reserve (struct inode *inode, size_t cnt, bool allocate)
+{
+  size_t block_cnt = extents_to_blocks (cnt);
+
+  if (cnt > inode->extent_cap)
+    {
+      size_t cap = cnt > 4 ? cnt * 2 : 8;
+      struct extent *extents = realloc (inode->extents,
+                                        cap * sizeof *extents);
+      if (extents == NULL)
+        return false;
+      inode->extents = extents;
+      inode->extent_cap = cap;
+    }
+
+  if (block_cnt > inode->block_cnt)
+    {
+      block_sector_t *blocks = realloc (inode->blocks,
+                                        block_cnt * sizeof *blocks);
+      if (blocks == NULL)
+        return false;
+      inode->blocks = blocks;
+      while (allocate && inode->block_cnt < block_cnt)
+        {
+          if (!free_map_allocate_near (1, inode->sector,
+                                       &blocks[inode->block_cnt]))
+            return false;
+          inode->block_cnt++;
+        }
+    }
+  return true;
+}
+
+/* Reads INODE's extents into memory.  INODE->DATA must already
+   hold its on-disk inode.  Returns false if memory runs out. */
+static bool
+extents_load (struct inode *inode)
+{
+  size_t cnt = inode->data.extent_cnt;
+  block_sector_t next = inode->data.next;
+  size_t i;
+
+  inode->extents = NULL;
+  inode->extent_cap = 0;
+  inode->blocks = NULL;
+  inode->block_cnt = 0;
+  if (!extents_reserve (inode, cnt, false))
+    {
+      free (inode->extents);
+      return false;
+    }
+
+  i = cnt < INLINE_EXTENT_CNT ? cnt : INLINE_EXTENT_CNT;
+  memcpy (inode->extents, inode->data.extents, i * sizeof *inode->extents);
+  for (; i < cnt; i += BLOCK_EXTENT_CNT)
+    {
+      size_t n = cnt - i < BLOCK_EXTENT_CNT ? cnt - i : BLOCK_EXTENT_CNT;
+
+      ASSERT (next != 0);
+      inode->blocks[inode->block_cnt++] = next;
+      cache_read_at (next, &inode->extents[i],
+                     offsetof (struct extent_block, extents),
+                     n * sizeof *inode->extents);
+      cache_read_at (next, &next, offsetof (struct extent_block, next),
+                     sizeof next);
+    }
+  return true;
+}
+
+/* Writes INODE's on-disk inode to disk, together with the extent
+   blocks holding extents FROM onward.  The extent blocks must
+   have been allocated with extents_reserve(). */
+static void
+extents_store (struct inode *inode, size_t from)
+{
+  size_t cnt = inode->data.extent_cnt;
+  size_t inline_cnt = cnt < INLINE_EXTENT_CNT ? cnt : INLINE_EXTENT_CNT;
+  size_t b;
+
+  ASSERT (inode->block_cnt >= extents_to_blocks (cnt));
+
+  memcpy (inode->data.extents, inode->extents,
+          inline_cnt * sizeof *inode->extents);
+  inode->data.next = inode->block_cnt > 0 ? inode->blocks[0] : 0;
+  cache_write (inode->sector, &inode->data);
+
+  /* The block before extent FROM may have gained a NEXT pointer. */
+  if (from > 0)
+    from--;
+  for (b = 0; b < inode->block_cnt; b++)
+    {
+      size_t first = INLINE_EXTENT_CNT + b * BLOCK_EXTENT_CNT;
+      block_sector_t next;
+      size_t n;
+
+      if (first >= cnt)
+        break;
+      if (first + BLOCK_EXTENT_CNT <= from)
+        continue;
+
+      n = cnt - first < BLOCK_EXTENT_CNT ? cnt - first : BLOCK_EXTENT_CNT;
+      next = b + 1 < inode->block_cnt ? inode->blocks[b + 1] : 0;
+      cache_write_at (inode->blocks[b], &next,
+                      offsetof (struct extent_block, next), sizeof next);
+      cache_write_at (inode->blocks[b], &inode->extents[first],
+                      offsetof (struct extent_block, extents),
+                      n * sizeof *inode->extents);
+    }
+}
+
+/* Returns the number of INODE's extents that start at or before
+   file sector OFS, found by binary search.  If it is nonzero,
+   the extent before that index is the only one that can contain
+   OFS. */
+static size_t
+extent_find (const struct inode *inode, uint32_t ofs)
+{
+  size_t lo = 0;
+  size_t hi = inode->data.extent_cnt;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (inode->extents[mid].ofs <= ofs)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Releases the extent blocks that INODE no longer needs. */
+static void
+extents_trim (struct inode *inode)
+{
+  while (inode->block_cnt > extents_to_blocks (inode->data.extent_cnt))
+    free_map_release (inode->blocks[--inode->block_cnt], 1);
+}
+
+/* Allocates disk sectors for up to CNT file sectors of INODE
+   starting at file sector OFS, which must not have one yet, and
+   zeros them.  IDX is extent_find()'s result for OFS.  Returns
+   the sector allocated for OFS, or 0 if memory or disk space
+   runs out. */
+static block_sector_t
+extent_allocate (struct inode *inode, uint32_t ofs, size_t idx, size_t cnt)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  size_t extent_cnt = inode->data.extent_cnt;
+  struct extent *prev = idx > 0 ? &inode->extents[idx - 1] : NULL;
+  struct extent *e;
+  block_sector_t hint, sector;
+  size_t i;
+
+  ASSERT (cnt > 0);
+
+  /* Stop short of the next extent. */
+  if (idx < extent_cnt && cnt > inode->extents[idx].ofs - ofs)
+    cnt = inode->extents[idx].ofs - ofs;
+
+  /* Grow PREV if OFS follows it in the file and the sectors
+     after it on disk are free.  Otherwise start a new extent as
+     near to PREV, or to the inode, as the free map allows.  If
+     no run of CNT sectors is free, settle for a single one. */
+  hint = prev != NULL ? prev->start + prev->length : inode->sector + 1;
+  for (;;)
+    {
+      if (prev != NULL && ofs == prev->ofs + prev->length
+          && free_map_allocate_at (hint, cnt))
+        {
+          sector = hint;
+          e = prev;
+          e->length += cnt;
+          break;
+        }
+
+      if (!extents_reserve (inode, extent_cnt + 1, true))
+        {
+          extents_trim (inode);
+          return 0;
+        }
+      if (free_map_allocate_near (cnt, hint, &sector))
+        {
+          e = &inode->extents[idx];
+          memmove (e + 1, e, (extent_cnt - idx) * sizeof *e);
+          e->ofs = ofs;
+          e->start = sector;
+          e->length = cnt;
+          inode->data.extent_cnt++;
+          break;
+        }
+
+      if (cnt == 1)
+        {
+          extents_trim (inode);
+          return 0;
+        }
+      cnt = 1;
+    }
+
+  for (i = 0; i < cnt; i++)
+    cache_write (sector + i, zeros);
+
+  /* Merge E with the next extent if the two now meet. */
+  i = e - inode->extents;
+  if (i + 1 < inode->data.extent_cnt)
+    {
+      struct extent *next = e + 1;
+      if (next->ofs == e->ofs + e->length
+          && next->start == e->start + e->length)
+        {
+          e->length += next->length;
+          memmove (next, next + 1,
+                   (inode->data.extent_cnt - i - 2) * sizeof *next);
+          inode->data.extent_cnt--;
+        }
+    }
+
+  extents_trim (inode);
+  extents_store (inode, i);
+  return sector;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   If no sector has been allocated for POS yet, allocates up to
+   ALLOC_CNT sectors for the file sectors starting at POS's, or
+   returns 0 if ALLOC_CNT is 0.  Also returns 0 if the disk is
+   full. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos, size_t alloc_cnt) 
 {
+  uint32_t ofs;
+  size_t idx;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  ASSERT (pos >= 0);
+
+  ofs = pos / BLOCK_SECTOR_SIZE;
+  idx = extent_find (inode, ofs);
+  if (idx > 0)
+    {
+      const struct extent *e = &inode->extents[idx - 1];
+      if (ofs < e->ofs + e->length)
+        return e->start + (ofs - e->ofs);
+    }
+  return alloc_cnt > 0 ? extent_allocate (inode, ofs, idx, alloc_cnt) : 0;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, hashed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  OPEN_INODES_LOCK
+   protects the table and every inode's OPEN_CNT. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if inode A precedes inode B. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  lock_init (&open_inodes_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data reads as zeros until it is written.
+   IS_DIR marks the inode as holding a directory.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
 
   ASSERT (length >= 0);
 
-  /* If this assertion fails, the inode structure is not exactly
+  /* If these assertions fail, the inode structure is not exactly
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct extent_block) == BLOCK_SECTOR_SIZE);
 
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
+      /* Data sectors are allocated as the file is written. */
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+      disk_inode->is_dir = is_dir;
+      cache_write (sector, disk_inode);
       free (disk_inode);
+      success = true;
     }
   return success;
 }
@@ -111,20 +411,22 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  lock_acquire (&open_inodes_lock);
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode;
     }
+  lock_release (&open_inodes_lock);
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
@@ -132,12 +434,36 @@ inode_open (block_sector_t sector)
     return NULL;
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  lock_init (&inode->lock);
+  rwlock_init (&inode->rwlock);
+  /* Read the inode without holding the table lock, so that opens
+     and closes of other inodes don't wait for the disk. */
+  cache_read (inode->sector, &inode->data);
+  if (!extents_load (inode))
+    {
+      free (inode);
+      return NULL;
+    }
+
+  /* Another thread may have opened the same sector meanwhile, in
+     which case its inode is used and this copy is thrown away. */
+  lock_acquire (&open_inodes_lock);
+  e = hash_insert (&open_inodes, &inode->elem);
+  if (e != NULL)
+    {
+      struct inode *open = hash_entry (e, struct inode, elem);
+      open->open_cnt++;
+      lock_release (&open_inodes_lock);
+      free (inode->extents);
+      free (inode->blocks);
+      free (inode);
+      return open;
+    }
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,7 +472,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -157,6 +487,38 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Returns true if INODE holds a directory. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->data.is_dir != 0;
+}
+
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
+/* Acquires INODE's lock, which callers use to make a sequence of
+   reads and writes of INODE atomic with respect to each other,
+   as the directory code does for each directory operation.
+   Plain inode_read_at() and inode_write_at() calls do not need
+   it. */
+void
+inode_lock (struct inode *inode)
+{
+  lock_acquire (&inode->lock);
+}
+
+/* Releases INODE's lock. */
+void
+inode_unlock (struct inode *inode)
+{
+  lock_release (&inode->lock);
+}
+
 /* Closes INODE and writes it to disk.
    If this was the last reference to INODE, frees its memory.
    If INODE was also a removed inode, frees its blocks. */
@@ -168,21 +530,33 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  if (--inode->open_cnt > 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
-        {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
-        }
+      lock_release (&open_inodes_lock);
+      return;
+    }
+
+  /* Remove from inode table and release lock. */
+  hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
 
-      free (inode); 
+  /* Deallocate blocks if removed. */
+  if (inode->removed) 
+    {
+      size_t i;
+
+      for (i = 0; i < inode->data.extent_cnt; i++)
+        free_map_release (inode->extents[i].start,
+                          inode->extents[i].length);
+      for (i = 0; i < inode->block_cnt; i++)
+        free_map_release (inode->blocks[i], 1);
+      free_map_release (inode->sector, 1);
     }
+
+  free (inode->extents);
+  free (inode->blocks);
+  free (inode); 
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -202,12 +576,12 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
+  rwlock_acquire_read (&inode->rwlock);
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (inode, offset, 0);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -220,99 +594,104 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      /* Copy out of the buffer cache, which reads the sector from
+         disk only if it is not already cached.  A sector that was
+         never written reads as zeros. */
+      if (sector_idx != 0)
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rwlock);
 
   return bytes_read;
 }
 
+/* Queues the sectors of INODE that follow byte OFFSET to be read
+   into the buffer cache in the background, up to the read-ahead
+   window or the end of the file.  The sector containing OFFSET
+   itself was just read and so is skipped. */
+void
+inode_read_ahead (struct inode *inode, off_t offset)
+{
+  off_t pos = ROUND_UP (offset, BLOCK_SECTOR_SIZE);
+  size_t i;
+
+  rwlock_acquire_read (&inode->rwlock);
+  for (i = 0; i < cache_read_ahead_sectors && pos < inode_length (inode); i++)
+    {
+      block_sector_t sector = byte_to_sector (inode, pos, 0);
+      if (sector != 0)
+        cache_read_ahead (sector);
+      pos += BLOCK_SECTOR_SIZE;
+    }
+  rwlock_release_read (&inode->rwlock);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up, the maximum file size is
+   reached or an error occurs.
+   Writing past end of file extends the inode.  Any gap between
+   the old end of file and OFFSET is left unallocated and reads
+   as zeros. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
+  rwlock_acquire_write (&inode->rwlock);
   if (inode->deny_write_cnt)
-    return 0;
+    {
+      rwlock_release_write (&inode->rwlock);
+      return 0;
+    }
 
   while (size > 0) 
     {
-      /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      /* Sector to write, starting byte offset within sector.
+         Sectors this write will reach are allocated as a run. */
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      size_t run = DIV_ROUND_UP (sector_ofs + size, BLOCK_SECTOR_SIZE);
+      block_sector_t sector_idx
+        = byte_to_sector (inode, offset, run < MAX_RUN ? run : MAX_RUN);
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left in sector. */
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
 
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      int chunk_size = size < sector_left ? size : sector_left;
+      if (sector_idx == 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      /* Write into the buffer cache.  If the sector contains data
+         before or after the chunk we're writing, the cache reads
+         it in first. */
+      cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                      chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* Extend the file only once its new data is in place, so that
+     readers never see a length covering unwritten bytes. */
+  if (offset > inode->data.length)
+    {
+      inode->data.length = offset;
+      cache_write (inode->sector, &inode->data);
+    }
+  rwlock_release_write (&inode->rwlock);
 
   return bytes_written;
 }
@@ -322,8 +701,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,12 +713,16 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
 }
 
-/* Returns the length, in bytes, of INODE's data. */
+/* Returns the length, in bytes, of INODE's data.
+   The length is read without locking, so a concurrent write may
+   make it stale as soon as it is returned. */
 off_t
 inode_length (const struct inode *inode)
 {
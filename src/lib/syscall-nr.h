@@ -28,7 +28,18 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Paging hints. */
+    SYS_MADVISE,                /* Advise on the use of a memory range. */
+    SYS_MSYNC                   /* Write a memory mapping back to its file. */
   };
 
+/* Advice for SYS_MADVISE. */
+#define MADV_NORMAL 0           /* No special treatment. */
+#define MADV_RANDOM 1           /* Expect random access; no read-ahead. */
+#define MADV_SEQUENTIAL 2       /* Expect sequential access. */
+#define MADV_WILLNEED 3         /* Will be accessed soon; read it in now. */
+#define MADV_DONTNEED 4         /* Won't be accessed soon; drop it. */
+
 #endif /* lib/syscall-nr.h */
@@ -0,0 +1,41 @@
+/* Writes to a file through a mapping, then drops the dirty page
+   with madvise (MADV_DONTNEED), and verifies that the data was
+   written back first, both through the mapping and by reading
+   the file with the read system call. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((void *) 0x10000000)
+
+void
+test_main (void)
+{
+  int handle;
+  mapid_t map;
+  char buf[1024];
+
+  CHECK (create ("sample.txt", strlen (sample)), "create \"sample.txt\"");
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"sample.txt\"");
+  CHECK (madvise (ACTUAL, 4096, MADV_SEQUENTIAL), "madvise MADV_SEQUENTIAL");
+  memcpy (ACTUAL, sample, strlen (sample));
+
+  /* Drop the dirty page.  It must be faulted back in from the
+     file with the data written to it. */
+  CHECK (madvise (ACTUAL, 4096, MADV_DONTNEED), "madvise MADV_DONTNEED");
+  CHECK (!memcmp (ACTUAL, sample, strlen (sample)),
+         "compare mapped data against written data");
+
+  /* Read back via read(). */
+  read (handle, buf, strlen (sample));
+  CHECK (!memcmp (buf, sample, strlen (sample)),
+         "compare read data against written data");
+
+  CHECK (!madvise (ACTUAL, 4096, 42), "madvise with unknown advice");
+  munmap (map);
+  close (handle);
+}
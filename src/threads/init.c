@@ -34,6 +34,7 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -140,6 +141,7 @@ main (void)
 
 #ifdef VM
   init_swap_table();
+  kswapd_init();
 #endif
 
   printf ("Boot complete.\n");
@@ -269,9 +271,17 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ra"))
+        cache_read_ahead_sectors = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-rp"))
+        {
+          if (!frame_set_policy (value))
+            PANIC ("unknown replacement policy `%s' (use -h for help)",
+                   value);
+        }
 #endif
 #endif
       else if (!strcmp (name, "-rs"))
@@ -281,6 +291,8 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-sp"))
+        stack_prefault_pages = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -395,14 +407,18 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ra=SECTORS        Read SECTORS ahead of sequential readers.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -rp=POLICY         Use page replacement POLICY: clock (default),\n"
+          "                     clock2 (two-handed clock) or clockpro.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -sp=PAGES          Map PAGES more pages when the stack grows.\n"
 #endif
           );
   shutdown_power_off ();
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "vm/frame.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -32,6 +33,7 @@ struct pool
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    size_t free_cnt;                    /* Number of free pages. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -40,6 +42,7 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static void adjust_free_cnt (struct pool *, int delta);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -60,16 +63,24 @@ palloc_init (size_t user_page_limit)
   init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
   init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
              user_pages, "user pool");
+
+  /* Give each user page a frame descriptor, indexed by its
+     position in the user pool. */
+  alloc_frame_table (user_pool.base, bitmap_size (user_pool.used_map));
 }
 
-// Pallocs new frame(s) and adds a record in the frame table
+// Pallocs new frame(s) and adds a record in the frame table. User frames are returned pinned (see frame_insert).
 void *
 palloc_get_multiple_aux (enum palloc_flags flags, size_t page_cnt, uint32_t *pd, void *vaddr)
 {
   void *kpage = palloc_get_multiple(flags, page_cnt);
   if (flags & PAL_USER)
   {
+    bool evicted = kpage == NULL;
     kpage = frame_insert(kpage, pd, vaddr, page_cnt);
+    /* An evicted frame still holds its old page. */
+    if (evicted && (flags & PAL_ZERO))
+      memset (kpage, 0, page_cnt * PGSIZE);
   }
   return kpage;
 }
@@ -102,7 +113,10 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   lock_release (&pool->lock);
 
   if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
+    {
+      pages = pool->base + PGSIZE * page_idx;
+      adjust_free_cnt (pool, -(int) page_cnt);
+    }
   else
     pages = NULL;
 
@@ -159,6 +173,16 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  adjust_free_cnt (pool, page_cnt);
+}
+
+/* Returns the number of free pages in the user pool.  The count
+   may be out of date by the time the caller looks at it, so it
+   should only be used as a hint. */
+size_t
+palloc_user_free_cnt (void)
+{
+  return user_pool.free_cnt;
 }
 
 /* Frees the page at PAGE. */
@@ -187,6 +211,18 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   lock_init (&p->lock);
   p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
   p->base = base + bm_pages * PGSIZE;
+  p->free_cnt = page_cnt;
+}
+
+/* Adds DELTA to the number of free pages in POOL.  Pages are
+   freed without holding the pool's lock, so interrupts are
+   disabled instead. */
+static void
+adjust_free_cnt (struct pool *pool, int delta)
+{
+  enum intr_level old_level = intr_disable ();
+  pool->free_cnt += delta;
+  intr_set_level (old_level);
 }
 
 /* Returns true if PAGE was allocated from POOL,
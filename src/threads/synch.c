@@ -344,3 +344,81 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RWLOCK.  Any number of threads may hold read
+   access to a readers-writer lock at once, but a thread holding
+   write access excludes all others.  Waiting writers are
+   preferred over new readers, so that a steady stream of readers
+   cannot starve a writer. */
+void
+rwlock_init (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_init (&rwlock->lock);
+  cond_init (&rwlock->can_read);
+  cond_init (&rwlock->can_write);
+  rwlock->reader_cnt = 0;
+  rwlock->writer_wait_cnt = 0;
+  rwlock->writing = false;
+}
+
+/* Acquires read access to RWLOCK, sleeping until no thread holds
+   or is waiting for write access. */
+void
+rwlock_acquire_read (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_acquire (&rwlock->lock);
+  while (rwlock->writing || rwlock->writer_wait_cnt > 0)
+    cond_wait (&rwlock->can_read, &rwlock->lock);
+  rwlock->reader_cnt++;
+  lock_release (&rwlock->lock);
+}
+
+/* Releases read access to RWLOCK. */
+void
+rwlock_release_read (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_acquire (&rwlock->lock);
+  ASSERT (rwlock->reader_cnt > 0);
+  if (--rwlock->reader_cnt == 0)
+    cond_signal (&rwlock->can_write, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
+
+/* Acquires write access to RWLOCK, sleeping until no other
+   thread holds it for reading or writing. */
+void
+rwlock_acquire_write (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_acquire (&rwlock->lock);
+  rwlock->writer_wait_cnt++;
+  while (rwlock->writing || rwlock->reader_cnt > 0)
+    cond_wait (&rwlock->can_write, &rwlock->lock);
+  rwlock->writer_wait_cnt--;
+  rwlock->writing = true;
+  lock_release (&rwlock->lock);
+}
+
+/* Releases write access to RWLOCK, handing it to a waiting
+   writer if there is one and otherwise to all waiting readers. */
+void
+rwlock_release_write (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_acquire (&rwlock->lock);
+  ASSERT (rwlock->writing);
+  rwlock->writing = false;
+  if (rwlock->writer_wait_cnt > 0)
+    cond_signal (&rwlock->can_write, &rwlock->lock);
+  else
+    cond_broadcast (&rwlock->can_read, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
@@ -9,6 +9,8 @@
 #include "threads/vaddr.h"
 #include "threads/palloc.h"
 #include "vm/page.h"
+#include "vm/frame.h"
+#include <bitmap.h>
 #include "lib/kernel/hash.h"
 #include "lib/kernel/list.h"
 #include "userprog/pagedir.h"
@@ -17,6 +19,10 @@
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
+/* Number of page faults that read an evicted page back in from
+   swap or from its file. */
+static long long major_fault_cnt;
+
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
 
@@ -71,6 +77,7 @@ void
 exception_print_stats (void) 
 {
   printf ("Exception: %lld page faults\n", page_fault_cnt);
+  printf ("Exception: %lld major page faults\n", major_fault_cnt);
 }
 
 /* Handler for an exception (probably) caused by a user process. */
@@ -117,57 +124,75 @@ kill (struct intr_frame *f)
     }
 }
 
-// Checks whether fault_addr lies within spt_page. If yes, loads the relevant page into memory. Used for lazy-loading.
-static bool 
-check_and_possibly_load_page (struct spt_page *spt_page, void *fault_addr) 
-{
-  bool loaded = spt_page->loaded;
-  // Checks whether fault_addr lies in spt_page
-  bool too_low = fault_addr < spt_page->upage;
-  bool too_high = fault_addr > spt_page->upage + PGSIZE;
-  bool stack = spt_page->type == STACK;
-
-  if (loaded || too_low || too_high || stack)
-    return false;
-
-  acquire_filesystem_lock();
-  // Loads missing page from file or executable
-  spt_page->loaded = load_page(spt_page->file, spt_page->ofs, spt_page->upage, spt_page->read_bytes, spt_page->zero_bytes, spt_page->writable);
-  release_filesystem_lock();
-  
-  return true;
-}
-
-// Go over list of process's pages using SPT and see whether fault_addr belongs to any of the pages that are scheduled to be lazy-loaded. If a page is found, laod it into memory.
+// Looks up the range fault_addr lies in using the SPT and, if its page is scheduled to be lazy-loaded, loads it into memory.
+// Also reads the next range->fault_around pages of the range that aren't in memory yet (fault-around). The window doubles each time a fault lands just past the previous window, and is closed by a fault anywhere else, so only sequential readers pay for the extra reads.
+// A madvise hint on the range overrides this: MADV_RANDOM turns fault-around off, and MADV_SEQUENTIAL always reads FAULT_AROUND_MAX pages ahead and drops the pages behind the reader.
 bool
-attempt_load_pages(void *fault_addr)
+attempt_load_pages(void *fault_addr, bool write)
 {
   struct thread *t = thread_current();
   struct spt *spt = &t->spt;
-  struct list *pages = &spt->pages;
-  ASSERT(pages);
 
-  struct list_elem *e;
+  lock_acquire(&spt->ranges_lock);
 
-  lock_acquire(&spt->pages_lock);
+  struct spt_range *range = spt_find_range(spt, fault_addr);
 
-  // Ensures list has been initalized
-  ASSERT(list_begin(pages));
-  ASSERT(list_end(pages));
+  // Stack pages can't be loaded from a file
+  if (range == NULL || range->type == STACK)
+  {
+    lock_release(&spt->ranges_lock);
+    return false;
+  }
 
-  for (e = list_begin(pages); e != list_end(pages); e = list_next(e))
+  size_t idx = pg_no(fault_addr) - pg_no(range->upage);
+  if (spt_range_page_present(range, idx))
   {
-    struct spt_page *spt_page = list_entry (e, struct spt_page, elem);
-    ASSERT(spt_page);
+    lock_release(&spt->ranges_lock);
+    return false;
+  }
 
-    if (check_and_possibly_load_page(spt_page, fault_addr)) 
-    {
-      lock_release(&spt->pages_lock);
-      return true;
-    }
+  // The page was dropped by eviction
+  if (bitmap_test(range->loaded, idx))
+    major_fault_cnt++;
+
+  // Loads missing page from file or executable
+  if (!spt_range_load_page(range, idx, write))
+  {
+    lock_release(&spt->ranges_lock);
+    return false;
   }
-  lock_release(&spt->pages_lock);
-  return false;
+
+  switch (range->advice)
+  {
+    case MADV_RANDOM:
+      range->fault_around = 0;
+      break;
+    case MADV_SEQUENTIAL:
+      range->fault_around = FAULT_AROUND_MAX;
+      // Drop-behind: frees the pages the reader has gone past, keeping one window behind it
+      for (; range->drop_idx + FAULT_AROUND_MAX < idx; range->drop_idx++)
+        drop_page(t->pagedir, range->upage + range->drop_idx * PGSIZE);
+      break;
+    default:
+      if (idx == range->next_fault_idx)
+      {
+        range->fault_around = range->fault_around == 0 ? 1 : range->fault_around * 2;
+        if (range->fault_around > FAULT_AROUND_MAX)
+          range->fault_around = FAULT_AROUND_MAX;
+      }
+      else
+        range->fault_around = 0;
+  }
+
+  // Stops at the first page that is already present, as the reader has been there before
+  size_t next = idx + 1;
+  while (next < range->page_cnt && next <= idx + range->fault_around &&
+         !spt_range_page_present(range, next) && spt_range_load_page(range, next, false))
+    next++;
+  range->next_fault_idx = next;
+
+  lock_release(&spt->ranges_lock);
+  return true;
 }
 
 /* Page fault handler.  This is a skeleton that must be filled in
@@ -210,34 +235,29 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) == PF_W;
   user = (f->error_code & PF_U) == PF_U;
 
+  // Writing to a page shared copy-on-write gives the process its own copy of it
+  if (present && write && is_user_vaddr(fault_addr) && copy_on_write(fault_addr))
+    return;
+
   // Searches for fault_addr in SPT. If inside SPT, in most cases the fault is handled and process continues. Otherwise, terminte process.
   // Checks if fault_addr belongs to executable or memory-mapped file
-  if (!present && user && attempt_load_pages(fault_addr))
+  if (!present && user && attempt_load_pages(fault_addr, write))
     return;
   
-  // Check that the user stack pointer appears to be in stack space:
-  void *esp = f->esp;
-
-  ASSERT(esp);
-
-  // Check if it's a stack addr
-  // Since stack can only grow via PUSH or PUSHA assembly instruction, the fault_addr must be either 4 or 32 bytes below esp.
-  if (
-    is_user_vaddr(esp) && 
-    esp >= PHYS_BASE - STACK_LIMIT && 
-    (fault_addr == esp || fault_addr == esp - 4 || fault_addr == esp - 28 || fault_addr == esp - 32)) 
-  {
-    // Create new page
-    if (create_stack_page(&esp)) {
-      return;
-    }
-  }
+  // Checks if fault_addr is on the stack, growing it if fault_addr is just below esp.
+  // f->esp only holds the user stack pointer if the fault happened in user context.
+  if (!present && grow_stack(fault_addr, user ? f->esp : NULL))
+    return;
 
   if (!present && user)
   {
      uint32_t *pd = thread_current()->pagedir;
+     struct user_page *user_page = lookup_user_page(pd, fault_addr);
+     bool swapped = user_page != NULL && user_page->used_in == SWAP;
      if (pagedir_restore(pd,fault_addr))
      {
+        if (swapped)
+          major_fault_cnt++;
         return;
      }  
   }
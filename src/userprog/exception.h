@@ -9,6 +9,6 @@
 void exception_init (void);
 void exception_print_stats (void);
 
-bool attempt_load_pages(void *fault_addr);
+bool attempt_load_pages(void *fault_addr, bool write);
 
 #endif /* userprog/exception.h */
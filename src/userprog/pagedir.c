@@ -42,11 +42,16 @@ pagedir_destroy (uint32_t *pd)
         uint32_t *pte;
         
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
-          if (*pte & PTE_P) {
-            const void *kpage = pte_get_page (*pte);
+          if (*pte != 0 && pte_get_page (*pte) != get_zero_page ()) {
+            const void *upage = (void *) (((pde - pd) << PDSHIFT)
+                                          | ((pte - pt) << PTSHIFT));
             // Frees user_page associated with process (which might be either in frame or swap_slot)
-            remove_user_page(kpage, pd);
-            palloc_free_page (kpage);
+            bool found = remove_user_page(pd, upage);
+            // The frame is only freed if no other process shares it
+            if (*pte & PTE_P) {
+              ASSERT (found);
+              free_frame (pte_get_page (*pte));
+            }
           }
         palloc_free_page (pt);
       }
@@ -158,17 +163,48 @@ bool pagedir_restore(uint32_t *pd, const void *uaddr){
   {
     return NULL;
   }
-  
-  void* kpage = palloc_get_page_aux(PAL_USER | PAL_ZERO, pd, uaddr);
-  bool s = read_swap_slot(pd, uaddr, kpage);
-  if (!s)
+
+  // A page that was never mapped has no user_page, and mustn't be given a frame
+  struct user_page *user_page = lookup_user_page(pd, uaddr);
+  if (user_page == NULL)
   {
-    return NULL;
+    return false;
   }
-  
+
+  // If the page is shared, another process may read it back from swap first, even while the frame is being allocated. The page is then mapped to that process's frame.
+  while (user_page->used_in == SWAP)
+  {
+    void* kpage = palloc_get_page_aux(PAL_USER, pd, uaddr);
+    if (read_swap_slot(pd, uaddr, kpage))
+    {
+      pagedir_remap (pd, uaddr, kpage);
+      unpin_frame (kpage);
+      return (pagedir_get_page(pd, uaddr) != NULL);
+    }
+
+    // The page already had a user_page, so frame_insert didn't add one to the frame
+    unpin_frame (kpage);
+    palloc_free_page (kpage);
+  }
+
+  struct frame *frame = user_page->frame_or_swap_slot_ptr;
+  pagedir_remap (pd, uaddr, frame->address);
+  return true;
+}
+
+/* Points the PTE for user virtual page UPAGE in PD, which has
+   been marked "not present", at KPAGE and marks it present
+   again.  Other bits in the page table entry are preserved. */
+void
+pagedir_remap (uint32_t *pd, const void *upage, void *kpage)
+{
+  uint32_t *pte = lookup_page (pd, upage, false);
+
+  ASSERT (pte != NULL);
+  ASSERT (pg_ofs (kpage) == 0);
+
   *pte = pte_create_user (kpage, 0) | (*pte & PTE_FLAGS) | PTE_P;
-  return (pagedir_get_page(pd, uaddr) != NULL);
-  
+  invalidate_pagedir (pd);
 }
 
 /* Marks user virtual page UPAGE "not present" in page
@@ -220,6 +256,32 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
     }
 }
 
+/* Returns true if the PTE for virtual page VPAGE in PD is
+   writable.
+   Returns false if PD contains no PTE for VPAGE. */
+bool
+pagedir_is_writable (uint32_t *pd, const void *vpage) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  return pte != NULL && (*pte & PTE_W) != 0;
+}
+
+/* Set the writable bit to WRITABLE in the PTE for virtual page
+   VPAGE in PD. */
+void
+pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL) 
+    {
+      if (writable)
+        *pte |= PTE_W;
+      else 
+        *pte &= ~(uint32_t) PTE_W;
+      invalidate_pagedir (pd);
+    }
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD has been
    accessed recently, that is, between the time the PTE was
    installed and the last time it was cleared.  Returns false if
@@ -104,8 +104,6 @@ process_execute (const char *cmd_args)
   strlcpy(file_name, fst_str, strlen(fst_str) + 1);
 
   // Checks if executable exists
-  acquire_filesystem_lock();
-
   struct file *file = filesys_open(file_name);
 
   if (file == NULL) {
@@ -117,8 +115,6 @@ process_execute (const char *cmd_args)
     file_close(file);
   }
 
-  release_filesystem_lock();
-
   struct thread *t = thread_current();
 
   struct data_from_parent data_from_parent;
@@ -186,13 +182,14 @@ start_process (void *data_from_parent)
   struct thread *t = thread_current();
   const char *function_name = t->name;
 
-  // Gets spt_pages and mappings to frames from parent
+  // Gets spt_ranges and mappings to frames from parent
   share_pages (parent, t);
 
-  acquire_filesystem_lock();
+  // Starts in the parent's working directory
+  if (parent->cwd != NULL)
+    t->cwd = dir_reopen (parent->cwd);
   // Loads metadata about eexecutable to SPT
   success = load (function_name, &if_.eip, &if_.esp);
-  release_filesystem_lock();
 
   t->info->load_success = success;
   // Upping the sema on the line below gives control back to the parent
@@ -282,6 +279,9 @@ process_exit (void)
       pagedir_destroy (pd);
     }
   free_process_spt();
+
+  dir_close (cur->cwd);
+  cur->cwd = NULL;
 }
 
 /* Sets up the CPU for running user code in the current
@@ -364,6 +364,10 @@ struct Elf32_Phdr
 #define PF_R 4          /* Readable. */
 
 static bool setup_stack (void **esp);
+
+/* Number of pages mapped below the faulting one when the stack
+   grows.  Controlled by kernel command-line option "-sp". */
+size_t stack_prefault_pages = STACK_PREFAULT_DEFAULT;
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
                           uint32_t read_bytes, uint32_t zero_bytes,
@@ -413,9 +417,6 @@ load (const char *file_name, void (**eip) (void), void **esp)
       goto done; 
     }
   
-  struct spt *spt = &t->spt;
-  struct list *pages = &spt->pages;
-
   /* Read program headers. */
   file_ofs = ehdr.e_phoff;
   for (i = 0; i < ehdr.e_phnum; i++) 
@@ -566,69 +567,45 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 
   struct thread *t = thread_current ();
   struct spt *spt = &t->spt;
-  struct list *pages = &spt->pages;
+  size_t page_cnt = (read_bytes + zero_bytes) / PGSIZE;
 
-  file_seek (file, ofs);
-  while (read_bytes > 0 || zero_bytes > 0) 
-    {
-      /* Calculate how to fill this page.
-         We will read PAGE_READ_BYTES bytes from FILE
-         and zero the final PAGE_ZERO_BYTES bytes. */
-      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-      size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-      // Checks for a "clash", i.e. whether the page has already been loaded by an adjacent segment
-      struct spt_page *prev;
-
-      lock_acquire(&spt->pages_lock);
-      bool pages_is_empty = list_empty(pages);
-      if (!pages_is_empty) {
-        prev = list_entry(list_back(pages), struct spt_page, elem);
-      }
-      lock_release(&spt->pages_lock);
-
-      if (!pages_is_empty && prev->upage == upage) {
-        // If either segment is writable, page must be writable
-        prev->writable = prev->writable || writable;
-        // Set read_bytes to max of the two segments
-        prev->read_bytes = prev->read_bytes > read_bytes ? prev->read_bytes : read_bytes;
-        prev->zero_bytes = PGSIZE - prev->read_bytes;
-      } else {
-        struct spt_page *spt_page = (struct spt_page *) malloc(sizeof(struct spt_page));
-        if (spt_page == NULL) {
-          PANIC ("Failed to malloc struct spt_page in process.c/load");
-        }
+  if (type == EXECUTABLE) {
+    spt->exe_size += page_cnt * PGSIZE;
+  }
+
+  lock_acquire(&spt->ranges_lock);
+
+  struct spt_range *prev = spt_find_range(spt, upage);
+
+  // A range for this segment has already been copied from the parent
+  if (prev != NULL && prev->upage == upage && prev->ofs == ofs) {
+    lock_release(&spt->ranges_lock);
+    return true;
+  }
+
+  // Checks for a "clash", i.e. whether the first page is the last page of an adjacent segment. If so, the page is moved to this range.
+  if (prev != NULL && prev->upage + (prev->page_cnt - 1) * PGSIZE == upage) {
+    // If either segment is writable, page must be writable
+    writable = writable || prev->writable;
+    // Set read_bytes to max of the two segments
+    uint32_t prev_read_bytes = spt_range_read_bytes(prev, prev->page_cnt - 1);
+    if (read_bytes < prev_read_bytes) {
+      read_bytes = prev_read_bytes;
+    }
 
-        // Initializes spt_page
-        spt_page->ofs = ofs;
-        spt_page->upage = upage;
-        spt_page->read_bytes = page_read_bytes;
-        spt_page->zero_bytes = page_zero_bytes;
-        spt_page->writable = writable;
-
-        spt_page->type = type;
-        spt_page->loaded = false;
-        spt_page->file = file;
-
-        lock_acquire(&spt->pages_lock);
-        // Adds spt_page to pages list in spt
-        list_push_back(pages, &spt_page->elem);
-        lock_release(&spt->pages_lock);
-      }
-
-      // Moves file's head
-      file->pos += page_read_bytes;
-
-      /* Advance. */
-      if (type == EXECUTABLE) {
-        spt->exe_size += PGSIZE;
-      }
-      ofs += PGSIZE;
-      read_bytes -= page_read_bytes;
-      zero_bytes -= page_zero_bytes;
-      upage += PGSIZE;
+    prev->page_cnt--;
+    if (prev->page_cnt == 0) {
+      list_remove(&prev->elem);
+      spt_range_destroy(prev);
+    } else if (prev->read_bytes > prev->page_cnt * PGSIZE) {
+      prev->read_bytes = prev->page_cnt * PGSIZE;
     }
+  }
+
+  // Adds one range for the whole segment; its pages are set up when they fault
+  spt_insert_range(spt, spt_range_create(type, file, ofs, upage, page_cnt, read_bytes, writable));
 
+  lock_release(&spt->ranges_lock);
   return true;
 }
 
@@ -641,12 +618,16 @@ load_page (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
-  file_seek (file, ofs);
-  
   /* Check if virtual page already allocated */
   struct thread *t = thread_current ();
   uint8_t *kpage = pagedir_get_page (t->pagedir, upage);
-  
+  bool new_page = kpage == NULL;
+
+  /* Read-only pages are the same in every process running the
+     executable, so map the copy another process loaded, if any. */
+  if (new_page && !writable && share_exe_page (file, ofs, read_bytes, upage))
+    return true;
+
   if (!kpage)
   {
     /* Get a new page of memory. */
@@ -664,44 +645,81 @@ load_page (struct file *file, off_t ofs, uint8_t *upage,
     }        
   }
 
-  /* Load data into the page. */
-  int file_read_bytes = file_read (file, kpage, read_bytes);
+  /* Load data into the page.  Processes running the same
+     executable share FILE, so its position can't be relied on. */
+  int file_read_bytes = file_read_at (file, kpage, read_bytes, ofs);
   if (file_read_bytes != (int) read_bytes)
     {
       palloc_free_page (kpage);
       return false; 
     }
+
+  if (new_page && !writable)
+    cache_exe_frame (kpage, file, ofs, read_bytes);
+  if (new_page)
+    unpin_frame (kpage);
     
   return true;
 }
 
-// Creates an additional stack page and loads in memory. Used for stack growth.
-bool
-create_stack_page (void **esp)
+// Maps a zeroed frame at stack page upage, unless the page already has one or is in swap.
+static bool
+map_stack_page (uint8_t *upage)
 {
-  uint8_t *kpage;
-  bool success = false;
   struct thread *t = thread_current();
-  struct spt *spt = &t->spt;
-  // User address of new stack page
-  void *upage = (void *) PHYS_BASE - spt->stack_size - PGSIZE;
 
-  kpage = palloc_get_page_aux (PAL_USER | PAL_ZERO, t->pagedir, upage);
+  if (lookup_user_page (t->pagedir, upage) != NULL)
+    return false;
+
+  uint8_t *kpage = palloc_get_page_aux (PAL_USER | PAL_ZERO, t->pagedir, upage);
   if (!kpage) {
     PANIC("Failed to allocate page for stack");
   }
-  success = install_page (upage, kpage, true);
-  
-  if (success) {
-    spt_add_stack_page(upage);
-    spt->stack_size += PGSIZE;
-    *esp = (void *) PHYS_BASE - spt->stack_size;
-  } else {
+  if (!install_page (upage, kpage, true)) {
     palloc_free_page (kpage);
     PANIC("Failed to install stack page");
   }
+  unpin_frame (kpage);
+  return true;
+}
 
-  return success;
+// Handles a fault on the stack. The stack's SPT range covers every page the stack has grown to, and a page in it that hasn't been touched yet is given a zeroed frame.
+// A fault below the range grows it, if fault_addr is above the STACK_LIMIT floor and no more than 32 bytes below esp (PUSHA). Growth also maps up to stack_prefault_pages pages below the faulting one, so that a deep recursion takes fewer faults.
+// esp is NULL if the user stack pointer isn't known, in which case the stack isn't grown.
+bool
+grow_stack (void *fault_addr, void *esp)
+{
+  struct spt *spt = &thread_current()->spt;
+  uint8_t *floor = (uint8_t *) PHYS_BASE - STACK_LIMIT;
+  uint8_t *upage = pg_round_down (fault_addr);
+  uint8_t *bottom = (uint8_t *) PHYS_BASE - spt->stack_size;
+
+  if (!is_user_vaddr (fault_addr) || upage < floor)
+    return false;
+
+  if (upage >= bottom)
+    return map_stack_page (upage);
+
+  if (esp == NULL || (uint8_t *) fault_addr < (uint8_t *) esp - 32)
+    return false;
+
+  size_t prefault_cnt = (upage - floor) / PGSIZE;
+  if (prefault_cnt > stack_prefault_pages)
+    prefault_cnt = stack_prefault_pages;
+
+  uint8_t *new_bottom = upage - prefault_cnt * PGSIZE;
+  if (spt_overlaps (new_bottom, (bottom - new_bottom) / PGSIZE))
+    {
+      new_bottom = upage;
+      if (spt_overlaps (new_bottom, (bottom - new_bottom) / PGSIZE))
+        return false;
+    }
+  spt_reserve_stack (new_bottom);
+
+  // The pages between the old bottom and upage are mapped when they are touched
+  for (uint8_t *page = upage; page >= new_bottom; page -= PGSIZE)
+    map_stack_page (page);
+  return true;
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
@@ -709,7 +727,11 @@ create_stack_page (void **esp)
 static bool
 setup_stack (void **esp) 
 {
-  return create_stack_page(esp);
+  uint8_t *upage = (uint8_t *) PHYS_BASE - PGSIZE;
+
+  spt_reserve_stack (upage);
+  *esp = PHYS_BASE;
+  return map_stack_page (upage);
 }
 
 // Puts cmd line arguments on the stack
@@ -8,6 +8,12 @@
 // 4 MB
 #define STACK_LIMIT 0x400000
 
+// Default number of pages mapped below the faulting one when the stack grows
+#define STACK_PREFAULT_DEFAULT 4
+
+// Number of pages mapped below the faulting one when the stack grows. Controlled by kernel command-line option "-sp".
+extern size_t stack_prefault_pages;
+
 struct arg {
   char *str;
   struct list_elem elem;
@@ -26,8 +32,7 @@ struct data_from_parent {
 void init_hash_table (void);
 struct process_hash_item *get_process_item(void);
 
-bool
-create_stack_page (void **esp);
+bool grow_stack (void *fault_addr, void *esp);
 
 tid_t process_execute (const char *file_name);
 int process_wait (tid_t);
@@ -3,6 +3,7 @@
 #include "userprog/syscall.h"
 #include "userprog/process.h"
 #include "userprog/pagedir.h"
+#include "filesys/directory.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
 #include "filesys/inode.h"
@@ -61,10 +62,9 @@ hash_less_fun_b (const struct hash_elem *a,
   return hash_hash_fun_b(a,NULL) < hash_hash_fun_b(b,NULL);
 }
 
-struct lock filesystem_lock;
 struct lock console_lock;
 
-uint32_t (*syscall_functions[15])(void **, void **, void **) = {
+uint32_t (*syscall_functions[22])(void **, void **, void **) = {
     &halt_userprog,
     &exit_userprog,
     &exec_userprog,
@@ -79,13 +79,19 @@ uint32_t (*syscall_functions[15])(void **, void **, void **) = {
     &tell_userprog,
     &close_userprog,
     &mmap_userprog,
-    &munmap_userprog};
+    &munmap_userprog,
+    &chdir_userprog,
+    &mkdir_userprog,
+    &readdir_userprog,
+    &isdir_userprog,
+    &inumber_userprog,
+    &madvise_userprog,
+    &msync_userprog};
 
 void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
-  lock_init(&filesystem_lock);
   lock_init(&console_lock);
   mmap_init();
 }
@@ -107,7 +113,7 @@ syscall_handler (struct intr_frame *f)
   int syscall_num = (int) *sp;
 
   // In case wrong syscall_num has been passed, exit process
-  if (syscall_num < SYS_HALT || syscall_num > SYS_MUNMAP) {
+  if (syscall_num < SYS_HALT || syscall_num > SYS_MSYNC) {
     syscall_exit(-1);
   }
 
@@ -118,10 +124,10 @@ syscall_handler (struct intr_frame *f)
 
   // Validates user pointers
   if (syscall_num == SYS_CREATE || syscall_num == SYS_REMOVE || syscall_num == SYS_OPEN || syscall_num == SYS_EXEC || 
-  syscall_num == SYS_EXIT) {
+  syscall_num == SYS_EXIT || syscall_num == SYS_CHDIR || syscall_num == SYS_MKDIR) {
     validate_user_pointer((uint32_t *) arg1_ptr);
   }
-  if (syscall_num == SYS_READ || syscall_num == SYS_WRITE) {
+  if (syscall_num == SYS_READ || syscall_num == SYS_WRITE || syscall_num == SYS_READDIR) {
     validate_user_pointer((uint32_t *) arg2_ptr);
   }
   
@@ -263,16 +269,18 @@ write_userprog (void **arg1, void **arg2, void **arg3)
     return size;
   }
 
-  lock_acquire(&filesystem_lock);
   struct file *file = get_file_or_null(fd);
 
   if(!file || file->deny_write) {
-    lock_release(&filesystem_lock);
     return 0;
   }
 
+  // Directories can only be changed through mkdir and remove
+  if (inode_is_dir(file_get_inode(file))) {
+    return -1;
+  }
+
   off_t written_size = file_write (file, buffer, size);
-  lock_release(&filesystem_lock);
   return written_size;
 }
 
@@ -288,12 +296,22 @@ open_userprog (void **arg1, void **arg2 UNUSED, void **arg3 UNUSED)
   if (strlen(file) < 1)
     return -1;
 
-  lock_acquire(&filesystem_lock);
   struct file *file_struct = filesys_open(file);
-  lock_release(&filesystem_lock);
 
-  if (!file_struct)
+  if (!file_struct) {
     return -1;
+  }
+
+  // Directories also get a dir handle, which keeps readdir's position
+  struct dir *dir = NULL;
+  struct inode *inode = file_get_inode(file_struct);
+  if (inode_is_dir(inode)) {
+    dir = dir_open(inode_reopen(inode));
+    if (!dir) {
+      file_close(file_struct);
+      return -1;
+    }
+  }
   
   struct process_hash_item *p = get_process_item();
 
@@ -304,6 +322,7 @@ open_userprog (void **arg1, void **arg2 UNUSED, void **arg3 UNUSED)
   f->fd = p->next_fd;
   p->next_fd++;
   f->file = file_struct;
+  f->dir = dir;
   hash_insert(p->files, &f->elem);
   return f->fd;
 }
@@ -315,9 +334,7 @@ create_userprog (void **arg1, void **arg2, void **arg3 UNUSED)
   validate_user_pointer((uint32_t *) file);
   unsigned initial_size = *((unsigned *) arg2);
 
-  lock_acquire(&filesystem_lock);
   bool success = filesys_create(file, (off_t) initial_size);
-  lock_release(&filesystem_lock);
 
   return success;
 }
@@ -326,9 +343,7 @@ uint32_t
 remove_userprog (void **arg1, void **arg2 UNUSED, void **arg3 UNUSED)
 {
   const char *file = *((const char **) arg1);
-  lock_acquire(&filesystem_lock);
   bool success = filesys_remove(file);
-  lock_release(&filesystem_lock);
 
   return success;
 }
@@ -337,22 +352,19 @@ uint32_t
 close_userprog (void **arg1, void **arg2 UNUSED, void **arg3 UNUSED)
 {
   int fd = *((int *) arg1);
-  lock_acquire(&filesystem_lock);
 
   struct file_hash_item *f = get_file_hash_item_or_null(fd);
   if (!f) {
-    lock_release(&filesystem_lock);
     syscall_exit(-1);
   }
 
-  lock_release(&filesystem_lock);
-
   //Remove it from this processess hash table then 'close'
   if (!hash_delete(get_process_item()->files, &f->elem))
   {
     syscall_exit(-1);
     return VOID_RETURN;
   }
+  dir_close(f->dir);
   file_close(f->file);
   free(f);
   return VOID_RETURN;
@@ -386,16 +398,13 @@ read_userprog (void **arg1, void **arg2, void **arg3)
     return key_count;
   }
 
-  lock_acquire(&filesystem_lock);
   struct file *file = get_file_or_null(fd);
 
-  if(file == NULL) {
-    lock_release(&filesystem_lock);
+  if(file == NULL || inode_is_dir(file_get_inode(file))) {
     return -1;
   }
 
   off_t result = file_read (file, buffer, size);
-  lock_release(&filesystem_lock);
   return result;
 }
 
@@ -408,9 +417,7 @@ seek_userprog (void **arg1, void **arg2 UNUSED, void **arg3 UNUSED)
     return VOID_RETURN;
   }
 
-  lock_acquire(&filesystem_lock);
   struct file *file = get_file_or_null(fd);
-  lock_release(&filesystem_lock);
   if(file == NULL) {
     syscall_exit(-1);
   }
@@ -423,9 +430,7 @@ uint32_t
 tell_userprog (void **arg1, void **arg2 UNUSED, void **arg3 UNUSED)
 {
   int fd = *((int *) arg1);
-  lock_acquire(&filesystem_lock);
   struct file *file = get_file_or_null(fd);
-  lock_release(&filesystem_lock);
   if(file == NULL) {
     syscall_exit(-1);
     return VOID_RETURN;
@@ -448,13 +453,10 @@ mmap_userprog(void **arg1, void **arg2, void **arg3 UNUSED)
     return -1;
   }
 
-  lock_acquire(&filesystem_lock);
-
   struct file *target_file = get_file_or_null(fd);
 
   // If getting the file fails, exit with -1
   if (!target_file) {
-    lock_release(&filesystem_lock);
     syscall_exit(-1);
   }
 
@@ -463,7 +465,6 @@ mmap_userprog(void **arg1, void **arg2, void **arg3 UNUSED)
 
   // Ensure file is not empty
   if (size == 0) {
-    lock_release(&filesystem_lock);
     return MAP_FAILED;
   }
 
@@ -476,20 +477,15 @@ mmap_userprog(void **arg1, void **arg2, void **arg3 UNUSED)
 
   if (addr < thread_current()->spt.exe_size + EXE_BASE || maxaddr >= PHYS_BASE - STACK_LIMIT) 
   {
-    lock_release(&filesystem_lock);
     return MAP_FAILED;
   }
 
-  for (int i = 0; i < pgcnt; i++) {
-    if (spt_contains_uaddr (addr + PGSIZE * i)) {
-      release_filesystem_lock();
-      return MAP_FAILED;
-    }
+  if (spt_overlaps (addr, pgcnt)) {
+    return MAP_FAILED;
   }
 
   // Save file's metadata in SPT. Used for lazy-loading.
   spt_add_mmap_file (target_file, addr);
-  lock_release(&filesystem_lock);
 
 
   return mmap_add_mapping(fd, pgcnt, addr);
@@ -503,30 +499,111 @@ munmap_userprog(void **arg1, void **arg2 UNUSED, void **arg3 UNUSED)
   return VOID_RETURN;
 }
 
+uint32_t
+msync_userprog(void **arg1, void **arg2 UNUSED, void **arg3 UNUSED)
+{
+  mapid_t mapid = *((int *) arg1);
+  return mmap_sync_mapping(mapid);
+}
+
 
 uint32_t file_size_userprog (void **arg1, void **arg2 UNUSED, void **arg3 UNUSED) {
   int fd = *((int *) arg1);
-  lock_acquire(&filesystem_lock);
 
   struct file *target_file = get_file_or_null(fd);
 
   if(!target_file) {
-    lock_release(&filesystem_lock);
     syscall_exit(-1);
   }
 
   uint32_t fs = file_length (target_file);
-  lock_release(&filesystem_lock);
 
   return fs;
 }
 
-void acquire_filesystem_lock(void) {
-  lock_acquire(&filesystem_lock);
+uint32_t
+chdir_userprog (void **arg1, void **arg2 UNUSED, void **arg3 UNUSED)
+{
+  const char *dir = *((const char **) arg1);
+  validate_user_pointer((uint32_t *) dir);
+
+  bool success = filesys_chdir(dir);
+
+  return success;
+}
+
+uint32_t
+mkdir_userprog (void **arg1, void **arg2 UNUSED, void **arg3 UNUSED)
+{
+  const char *dir = *((const char **) arg1);
+  validate_user_pointer((uint32_t *) dir);
+
+  bool success = filesys_mkdir(dir);
+
+  return success;
+}
+
+uint32_t
+readdir_userprog (void **arg1, void **arg2, void **arg3 UNUSED)
+{
+  int fd = *((int *) arg1);
+  char *name = *((char **) arg2);
+  validate_user_pointer((uint32_t *) name);
+
+  struct file_hash_item *f = get_file_hash_item_or_null(fd);
+  bool success = f && f->dir && dir_readdir(f->dir, name);
+
+  return success;
+}
+
+uint32_t
+isdir_userprog (void **arg1, void **arg2 UNUSED, void **arg3 UNUSED)
+{
+  int fd = *((int *) arg1);
+  struct file_hash_item *f = get_file_hash_item_or_null(fd);
+  return f && f->dir;
+}
+
+uint32_t
+inumber_userprog (void **arg1, void **arg2 UNUSED, void **arg3 UNUSED)
+{
+  int fd = *((int *) arg1);
+  struct file_hash_item *f = get_file_hash_item_or_null(fd);
+  if (!f) {
+    return -1;
+  }
+  return inode_get_inumber(file_get_inode(f->file));
+}
+
+uint32_t
+madvise_userprog (void **arg1, void **arg2, void **arg3)
+{
+  uint8_t *addr = *((uint8_t **) arg1);
+  size_t length = *((size_t *) arg2);
+  int advice = *((int *) arg3);
+
+  if (pg_ofs(addr) != 0 || length == 0 || addr + length < addr || !is_user_vaddr(addr + length - 1)) {
+    return false;
+  }
+
+  return spt_advise(addr, length, advice);
 }
 
-void release_filesystem_lock(void) {
-  lock_release(&filesystem_lock);
+// Pins or unpins the string at str, a page at a time up to the page holding its '\0', so that a path of any length is covered. Each page is only read once it's pinned.
+static bool pin_or_unpin_string (const char *str, pin_or_unpin_obj *pin_or_unpin_obj) {
+  const char *c = str;
+
+  while (true) {
+    const char *page_end = (const char *) pg_round_down(c) + PGSIZE;
+    if (!is_user_vaddr(c) || !pin_or_unpin_obj((void *) c, page_end - c)) {
+      return false;
+    }
+    for (; c < page_end; c++) {
+      if (*c == '\0') {
+        return true;
+      }
+    }
+  }
 }
 
 // Pinning helper function
@@ -543,6 +620,11 @@ static bool pin_or_unpin_arguments (int syscall_num, void **arg1_ptr, void **arg
     case SYS_CLOSE:
     case SYS_MMAP:
     case SYS_MUNMAP:
+    case SYS_READDIR:
+    case SYS_ISDIR:
+    case SYS_INUMBER:
+    case SYS_MADVISE:
+    case SYS_MSYNC:
       // Pin an int
       ASSERT (is_user_vaddr(arg1_ptr));
       if (!pin_or_unpin_obj(arg1_ptr, sizeof(int *))) {
@@ -553,7 +635,9 @@ static bool pin_or_unpin_arguments (int syscall_num, void **arg1_ptr, void **arg
     case SYS_EXEC:
     case SYS_REMOVE:
     case SYS_OPEN:
-      // Pin a char *, and all the chars it points to up to 15 characters (because char * points to filename and filename is at most 14 characters long + '\0' character at the end)
+    case SYS_CHDIR:
+    case SYS_MKDIR:
+      // Pin a char *, and all the chars it points to including the '\0' at the end (paths can be longer than a single file name)
       ASSERT (is_user_vaddr(arg1_ptr));
       if (!pin_or_unpin_obj(arg1_ptr, sizeof(char *))) {
         //PANIC ("No frames were pinned / unpinned");
@@ -561,7 +645,7 @@ static bool pin_or_unpin_arguments (int syscall_num, void **arg1_ptr, void **arg
       }
       char *char_ptr = (char *) *arg1_ptr;
       ASSERT (is_user_vaddr(char_ptr));
-      if (!pin_or_unpin_obj(char_ptr, MAX_FILENAME_LENGTH + 1)) {
+      if (!pin_or_unpin_string(char_ptr, pin_or_unpin_obj)) {
         //PANIC ("No frames were pinned / unpinned");
         return false;
       }
@@ -572,6 +656,7 @@ static bool pin_or_unpin_arguments (int syscall_num, void **arg1_ptr, void **arg
   switch (syscall_num) {
     case SYS_CREATE:
     case SYS_SEEK:
+    case SYS_MADVISE:
       // Pin an int 
       ASSERT (is_user_vaddr(arg2_ptr));
       if (!pin_or_unpin_obj(arg2_ptr, sizeof(int *))) {
@@ -581,6 +666,31 @@ static bool pin_or_unpin_arguments (int syscall_num, void **arg1_ptr, void **arg
       break;
   }
 
+  // Pin third argument (if it's an int other than the size of a buffer)
+  switch (syscall_num) {
+    case SYS_MADVISE:
+      ASSERT (is_user_vaddr(arg3_ptr));
+      if (!pin_or_unpin_obj(arg3_ptr, sizeof(int *))) {
+        return false;
+      }
+      break;
+  }
+
+  // Pin second argument for readdir, the buffer the name is written to
+  switch (syscall_num) {
+    case SYS_READDIR:
+      ASSERT (is_user_vaddr(arg2_ptr));
+      if (!pin_or_unpin_obj(arg2_ptr, sizeof(char *))) {
+        return false;
+      }
+      char *name_ptr = (char *) *arg2_ptr;
+      ASSERT (is_user_vaddr(name_ptr));
+      if (!pin_or_unpin_obj(name_ptr, READDIR_MAX_LEN + 1)) {
+        return false;
+      }
+      break;
+  }
+
   // Pin second and third arguments for read and write (it's done in one switch-case statement because the third argument informs us how big the string in the second argument is)
   switch (syscall_num) {
     case SYS_READ:
@@ -611,6 +721,15 @@ static bool pin_or_unpin_arguments (int syscall_num, void **arg1_ptr, void **arg
 
 // Pinning
 static bool pin_arguments (int syscall_num, void **arg1_ptr, void **arg2_ptr, void **arg3_ptr) {
+  // The kernel writes to these buffers while they're pinned, so they must not be shared copy-on-write
+  switch (syscall_num) {
+    case SYS_READ:
+      unshare_obj(*arg2_ptr, *((int *) arg3_ptr));
+      break;
+    case SYS_READDIR:
+      unshare_obj(*arg2_ptr, READDIR_MAX_LEN + 1);
+      break;
+  }
   return pin_or_unpin_arguments(syscall_num, arg1_ptr, arg2_ptr, arg3_ptr, pin_obj);
 }
 
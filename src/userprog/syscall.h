@@ -24,6 +24,7 @@ struct process_hash_item
 struct file_hash_item
 {
   struct file *file;  //The actual file
+  struct dir *dir;    //Open directory for readdir, or NULL if file isn't one
   int fd;      //File descriptor, for the hash function
   struct hash_elem elem;
 };
@@ -56,8 +57,13 @@ uint32_t tell_userprog (void **, void **, void **);
 uint32_t mmap_userprog (void **, void **, void **);
 uint32_t munmap_userprog (void **, void **, void **);
 uint32_t file_size_userprog (void **, void **, void **);
+uint32_t chdir_userprog (void **, void **, void **);
+uint32_t mkdir_userprog (void **, void **, void **);
+uint32_t readdir_userprog (void **, void **, void **);
+uint32_t isdir_userprog (void **, void **, void **);
+uint32_t inumber_userprog (void **, void **, void **);
+uint32_t madvise_userprog (void **, void **, void **);
+uint32_t msync_userprog (void **, void **, void **);
 
-void acquire_filesystem_lock(void);
-void release_filesystem_lock(void);
 
 #endif /* userprog/syscall.h */
@@ -3,106 +3,199 @@
 #include <hash.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
 #include "threads/palloc.h"
 #include "threads/malloc.h"
 #include "userprog/pagedir.h"
 #include "threads/pte.h"
+#include "threads/vaddr.h"
 #include "vm/swap.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/thread.h"
 #include <list.h>
 
 static struct frametable frame_table;
-static struct list all_user_pages;
-static struct lock all_user_pages_lock;
+// Reverse map: finds the user_page for a (pd, uaddr) pair, whether it is in a frame or in swap
+static struct hash user_page_map;
+// Lock on user_page_map
+static struct lock user_page_map_lock;
+// Executable page cache: finds the frame holding a read-only page of an executable by (inode sector, offset, bytes read), so that all processes running it share one copy
+static struct hash exe_frames;
+// Lock on exe_frames. Must be acquired before a frame's user_pages_lock.
+static struct lock exe_frames_lock;
+// Serializes evictions, so that the page-out daemon and a faulting thread don't pick the same victims
+static struct lock evict_lock;
+// Wakes up the page-out daemon
+static struct semaphore kswapd_sema;
+// Number of frames evicted
+static unsigned long long evict_cnt;
+// Read-only page of zeros, mapped by every process for zero-fill pages until they are written (see attempt_load_pages). It is not in the user pool, so it's never evicted.
+static void *zero_page;
+
+// A page replacement policy. The clock hand of the frame table goes round the frames, and the policy decides which of them are evicted.
+struct replacement_policy
+{
+  // Name used to select the policy with the "-rp" option
+  const char *name;
+  // Returns true if the frame under the clock hand should be evicted. Called with evict_lock and the frame's user_pages_lock held, for frames that are in use and not pinned.
+  bool (*select) (struct frame *frame);
+  // Called with evict_lock held each time the clock hand moves on. May be NULL.
+  void (*advance) (void);
+  // Called by frame_insert when a page is brought into a frame, before the frame can be evicted. May be NULL.
+  void (*insert) (struct frame *frame);
+  // Number of rounds of the clock within which the policy selects a frame, unless every frame is pinned or accessed again in the meantime
+  size_t rounds;
+};
+
+static bool clock_select (struct frame *frame);
+static bool two_handed_select (struct frame *frame);
+static void two_handed_advance (void);
+static bool clock_pro_select (struct frame *frame);
+static void clock_pro_insert (struct frame *frame);
+
+static const struct replacement_policy policies[] = {
+  {"clock", clock_select, NULL, NULL, 2},
+  {"clock2", two_handed_select, two_handed_advance, NULL, 2},
+  // A hot page has its accessed bit cleared in one round, is demoted to cold in the next and is evicted in the third
+  {"clockpro", clock_pro_select, NULL, clock_pro_insert, 3},
+};
+
+// Policy in use. Second chance by default.
+static const struct replacement_policy *policy = &policies[0];
+
+// Front hand of the two-handed clock. NULL until the first eviction.
+static struct list_elem *front_hand;
 
 static void fix_queue(struct frame* new);
-static bool at_least_one_accessed_or_dirty (struct list *user_pages);
-static void reset_pagedirs_of_user_pages (struct list *user_pages);
+static bool at_least_one_accessed (struct list *user_pages);
+static bool at_least_one_dirty (struct list *user_pages);
+static bool evict_to_file (struct frame *frame);
 static void clear_pages_of_user_pages (struct list *user_pages);
+static void clear_dirty_bits_of_user_pages (struct list *user_pages);
 static void reset_accessed_bits_of_user_pages (struct list *user_pages);
 static void user_pages_forall (struct list *user_pages, pagedir_generic_function *pagedir_generic_function);
 
-unsigned 
-frame_hash(const struct hash_elem *e, void *aux UNUSED)
+static unsigned
+user_page_hash (const struct hash_elem *e, void *aux UNUSED)
 {
-  struct frame *f = hash_entry(e, struct frame, elem);
-  return (unsigned) f -> address;
+  struct user_page *user_page = hash_entry(e, struct user_page, map_elem);
+  return hash_int((uintptr_t) user_page->pd ^ (uintptr_t) user_page->uaddr);
 }
 
-bool 
-frame_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+static bool
+user_page_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
 {
-  return frame_hash(a,NULL) < frame_hash(b, NULL);
+  struct user_page *a = hash_entry(a_, struct user_page, map_elem);
+  struct user_page *b = hash_entry(b_, struct user_page, map_elem);
+  if (a->pd != b->pd) {
+    return a->pd < b->pd;
+  }
+  return a->uaddr < b->uaddr;
 }
 
-// For freeing frames when OS exits
-static void frame_destroy (struct hash_elem *e, void *aux) {
-  struct frame *frame = hash_entry(e, struct frame, elem);
-  free(frame);
+static unsigned
+exe_frame_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  struct frame *frame = hash_entry(e, struct frame, exe_elem);
+  return hash_int(frame->exe_sector ^ (frame->exe_ofs << 8) ^ (frame->exe_read_bytes << 20));
 }
 
-void 
-init_frame_table(void)
+static bool
+exe_frame_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
 {
+  struct frame *a = hash_entry(a_, struct frame, exe_elem);
+  struct frame *b = hash_entry(b_, struct frame, exe_elem);
+  if (a->exe_sector != b->exe_sector) {
+    return a->exe_sector < b->exe_sector;
+  }
+  if (a->exe_ofs != b->exe_ofs) {
+    return a->exe_ofs < b->exe_ofs;
+  }
+  return a->exe_read_bytes < b->exe_read_bytes;
+}
+
+// Allocates a struct frame for each of the page_cnt pages of the user pool, which starts at base, and puts them all in the frame table.
+// Called by palloc_init, before anything else uses the frame table.
+void
+alloc_frame_table (void *base, size_t page_cnt)
+{
+  size_t table_pages = DIV_ROUND_UP(page_cnt * sizeof(struct frame), PGSIZE);
+
+  frame_table.frames = palloc_get_multiple(PAL_ASSERT | PAL_ZERO, table_pages);
+  frame_table.base = base;
+  frame_table.frame_cnt = page_cnt;
   list_init(&frame_table.list);
-  hash_init(&frame_table.table, &frame_hash, &frame_less, NULL);
   lock_init(&frame_table.lock);
-  list_init(&all_user_pages);
-  lock_init(&all_user_pages_lock);
+
+  for (size_t i = 0; i < page_cnt; i++) {
+    struct frame *frame = &frame_table.frames[i];
+    frame->address = (uint8_t *) base + i * PGSIZE;
+    list_init(&frame->user_pages);
+    lock_init(&frame->user_pages_lock);
+    list_push_back(&frame_table.list, &frame->list_elem);
+  }
+  frame_table.current = page_cnt > 0 ? list_front(&frame_table.list) : NULL;
+}
+
+void 
+init_frame_table(void)
+{
+  hash_init(&user_page_map, user_page_hash, user_page_less, NULL);
+  lock_init(&user_page_map_lock);
+  hash_init(&exe_frames, exe_frame_hash, exe_frame_less, NULL);
+  lock_init(&exe_frames_lock);
+  lock_init(&evict_lock);
+  sema_init(&kswapd_sema, 0);
+  zero_page = palloc_get_page(PAL_ASSERT | PAL_ZERO);
 }
 
 /* Looks up frame with kpage in the frame table 
-   returns NULL if the frame does not exist */
+   returns NULL if kpage is not in the user pool */
 struct frame *
 lookup_frame(void *kpage)
 {
-  //search table using dummy elem
-  struct frame dummy_f;
-  dummy_f.address = kpage;
-  struct hash_elem *f = hash_find(&frame_table.table, &dummy_f.elem);
+  uint8_t *base = frame_table.base;
+  if ((uint8_t *) kpage < base) {
+    return NULL;
+  }
 
-  // miss
-  if (!f){
+  size_t idx = ((uint8_t *) kpage - base) / PGSIZE;
+  if (idx >= frame_table.frame_cnt) {
     return NULL;
   }
-  //hit
-  struct frame *frame = hash_entry(f, struct frame, elem);
-  return frame;
+  return &frame_table.frames[idx];
 }
 
-static struct frame *evict (struct list_elem *current);
+static struct frame *evict (void);
 
-/* Returns a new frame. Evicts if needed */
+/* Returns a new frame. Evicts if needed.
+   The frame is pinned, so that it isn't evicted before the caller has
+   filled it and mapped it; the caller then unpins it (see unpin_frame). */
 void * 
 frame_insert (void* kpage, uint32_t *pd, void *vaddr, int size)
 {
   struct frame *frame;
 	if (!kpage)
 	{
-    frame = evict(frame_table.current);
+    // Only happens if the page-out daemon can't keep up. Every frame may be pinned or in the middle of being set up, in which case other threads have to make progress first.
+    while ((frame = evict()) == NULL) {
+      thread_yield();
+    }
   }
   else
   {
-    frame = malloc(sizeof(struct frame));
-    if (frame == NULL) {
-      PANIC ("Malloc failed");
-    }
-    frame->address = kpage;
-    if (!frame_table.current)
-    {
-      lock_acquire(&frame_table.lock);
-      list_push_front(&frame_table.list, &frame->list_elem);
-      lock_release(&frame_table.lock);
-
-      frame_table.current = &frame->list_elem;
-    }
-    list_init(&frame->user_pages);
-    lock_init(&frame->user_pages_lock);
-    
-    list_insert(frame_table.current, &frame->list_elem);
-    hash_insert(&frame_table.table,&frame->elem);
+    frame = lookup_frame(kpage);
 	}
 
   ASSERT (frame);
+  frame->exe_cached = false;
+  frame->file = NULL;
+  if (policy->insert != NULL) {
+    policy->insert(frame);
+  }
 
   struct user_page *user_page = malloc(sizeof(struct user_page));
   if (user_page == NULL) {
@@ -110,117 +203,499 @@ frame_insert (void* kpage, uint32_t *pd, void *vaddr, int size)
   }
 
   user_page->pd = pd;
-  user_page->uaddr = vaddr;
+  user_page->uaddr = pg_round_down(vaddr);
   user_page->frame_or_swap_slot_ptr = frame;
   user_page->used_in = FRAME;
 
-  // Adds user_page to frame
-  lock_acquire(&frame->user_pages_lock);
-  list_push_back(&frame->user_pages, &user_page->elem);
-  lock_release(&frame->user_pages_lock);
-
-  // Adds user_page to static list all_user_pages
-  lock_acquire(&all_user_pages_lock);
-  list_push_back(&all_user_pages, &user_page->allelem);
-  lock_release(&all_user_pages_lock);
+  // Adds user_page to the reverse map. If the page is coming back from swap it already has a user_page, which read_swap_slot moves into this frame.
+  if (!add_user_page(user_page)) {
+    free(user_page);
+  } else {
+    // Adds user_page to frame
+    lock_acquire(&frame->user_pages_lock);
+    list_push_back(&frame->user_pages, &user_page->elem);
+    lock_release(&frame->user_pages_lock);
+  }
 
   frame->size = size; // Should always be 1
-  frame->pinned = false;
+  frame->pinned = true;
+
+  if (palloc_user_free_cnt() < FREE_FRAMES_LOW) {
+    sema_up(&kswapd_sema);
+  }
   return frame->address;
 }
 
-// Free page_cnt frames starting at address pages. Usually (maybe even always) page_cnt = 1
-// Causing page fault!
+// Frees the frame at kpage unless other processes still map it. Must be called after the caller's user_page has been removed.
+// The struct frame stays in the frame table and is reused by frame_insert when kpage is handed out again.
 void 
-free_frames(void* pages, size_t page_cnt)
+free_frame (void *kpage)
 {
-  struct frame *dummy_f;
-  dummy_f -> address = pages;
+  struct frame *frame = lookup_frame(kpage);
+  if (frame == NULL) {
+    palloc_free_page(kpage);
+    return;
+  }
 
-  lock_acquire(&frame_table.lock);
-  struct hash_elem *elem = hash_delete(&frame_table.table, &dummy_f -> elem);
-  lock_release(&frame_table.lock);
+  lock_acquire(&exe_frames_lock);
+  lock_acquire(&frame->user_pages_lock);
 
-  if (elem)
-  {
-    struct frame *f = hash_entry(elem, struct frame, elem);
+  bool unused = list_empty(&frame->user_pages);
+  if (unused) {
+    if (frame->exe_in_hash) {
+      hash_delete(&exe_frames, &frame->exe_elem);
+      frame->exe_in_hash = false;
+    }
+    frame->exe_cached = false;
+  }
 
-    lock_acquire(&frame_table.lock);
-    list_remove(&f->list_elem);
-    lock_release(&frame_table.lock);
+  lock_release(&frame->user_pages_lock);
+  lock_release(&exe_frames_lock);
 
-    free(f);
+  if (unused) {
+    palloc_free_page(kpage);
   }
 }
 
-/* Implements a second chance eviction algorithm
-   will allocate a swap slot if needed */
+// Maps upage read-only to the frame already holding the executable page at (file, ofs) with read_bytes bytes read from it, if there is one. Returns true if the page is now shared.
+bool
+share_exe_page (struct file *file, off_t ofs, uint32_t read_bytes, void *upage)
+{
+  uint32_t *pd = thread_current()->pagedir;
+  struct frame dummy_f;
+  dummy_f.exe_sector = inode_get_inumber(file_get_inode(file));
+  dummy_f.exe_ofs = ofs;
+  dummy_f.exe_read_bytes = read_bytes;
+  bool shared = false;
+
+  lock_acquire(&exe_frames_lock);
+
+  struct hash_elem *e = hash_find(&exe_frames, &dummy_f.exe_elem);
+  if (e != NULL) {
+    struct frame *frame = hash_entry(e, struct frame, exe_elem);
+
+    lock_acquire(&frame->user_pages_lock);
+    if (!frame->exe_cached) {
+      // Frame has been evicted since it was cached
+      hash_delete(&exe_frames, e);
+      frame->exe_in_hash = false;
+    } else {
+      struct user_page *user_page = malloc(sizeof(struct user_page));
+      if (user_page == NULL) {
+        PANIC ("Malloc failed");
+      }
+
+      user_page->pd = pd;
+      user_page->uaddr = upage;
+      user_page->frame_or_swap_slot_ptr = frame;
+      user_page->used_in = FRAME;
+
+      if (add_user_page(user_page)) {
+        if (!pagedir_set_page(pd, upage, frame->address, false)) {
+          PANIC ("Failed to map shared executable page");
+        }
+        list_push_back(&frame->user_pages, &user_page->elem);
+        shared = true;
+      } else {
+        free(user_page);
+      }
+    }
+    lock_release(&frame->user_pages_lock);
+  }
+
+  lock_release(&exe_frames_lock);
+  return shared;
+}
+
+// Records that the frame at kpage holds bytes bytes read from file at ofs, followed by zeros, so that it can be evicted without going to swap. If writeback is true, the page is written back to the file if it's dirty when evicted.
+void
+set_frame_file (void *kpage, struct file *file, off_t ofs, uint32_t bytes, bool writeback)
+{
+  struct frame *frame = lookup_frame(kpage);
+  if (frame == NULL) {
+    return;
+  }
+
+  lock_acquire(&frame->user_pages_lock);
+  frame->file = file;
+  frame->file_ofs = ofs;
+  frame->file_bytes = bytes;
+  frame->file_writeback = writeback;
+  lock_release(&frame->user_pages_lock);
+}
+
+// Records that the frame at kpage holds the read-only executable page at (file, ofs), with read_bytes bytes read from it, so that other processes can share it
+void
+cache_exe_frame (void *kpage, struct file *file, off_t ofs, uint32_t read_bytes)
+{
+  struct frame *frame = lookup_frame(kpage);
+  if (frame == NULL) {
+    return;
+  }
+
+  lock_acquire(&exe_frames_lock);
+
+  if (frame->exe_in_hash) {
+    hash_delete(&exe_frames, &frame->exe_elem);
+  }
+  frame->exe_sector = inode_get_inumber(file_get_inode(file));
+  frame->exe_ofs = ofs;
+  frame->exe_read_bytes = read_bytes;
+
+  // Another frame may still be cached under the same key if it was evicted, or if two processes loaded the page at the same time
+  struct hash_elem *old = hash_replace(&exe_frames, &frame->exe_elem);
+  if (old != NULL) {
+    struct frame *old_frame = hash_entry(old, struct frame, exe_elem);
+    old_frame->exe_in_hash = false;
+    old_frame->exe_cached = false;
+  }
+  frame->exe_in_hash = true;
+  frame->exe_cached = true;
+
+  lock_release(&exe_frames_lock);
+}
+
+// Returns the frame after current in the frame table, going back to the front after the last one. Must be called with frame_table.lock held.
+static struct list_elem *
+clock_next (struct list_elem *current)
+{
+  struct list_elem *next = list_next(current);
+  if (is_tail(next))
+  {
+    return list_front(&frame_table.list);
+  }
+  return next;
+}
+
+// Moves the clock hand of the frame table to the next frame
+static struct list_elem *
+advance_clock (struct list_elem *current)
+{
+  lock_acquire(&frame_table.lock);
+
+  current = clock_next(current);
+  frame_table.current = current;
+
+  lock_release(&frame_table.lock);
+  return current;
+}
+
+/* Goes round the frame table with the clock hand, letting the
+   replacement policy pick the victims.
+   Will allocate a swap slot if needed.
+   Once a victim is found, up to SWAP_CLUSTER - 1 more are taken from
+   the frames that follow it and written to swap together with it.
+   The extra victims' pages are freed, so the next few allocations
+   don't have to evict.
+   Returns NULL if no victim is found after going round the frame
+   table twice. */
 static struct frame *
-evict (struct list_elem *current) 
+evict (void) 
 {
-  struct list_elem* next;
-  bool save;
+  struct frame *victims[SWAP_CLUSTER];
+  size_t victim_cnt = 0;
+  // Number of frames left to look at for more victims once one has been found
+  size_t scan_cnt = 2 * SWAP_CLUSTER;
   struct frame *frame;
-  struct list *user_pages;
+
+  lock_acquire(&evict_lock);
+
+  lock_acquire(&frame_table.lock);
+  struct list_elem *current = frame_table.current;
+  // Number of frames left to look at before giving up on finding a victim
+  size_t budget = policy->rounds * frame_table.frame_cnt;
+  lock_release(&frame_table.lock);
+
+  if (current == NULL) {
+    lock_release(&evict_lock);
+    return NULL;
+  }
 
   do {
     frame = list_entry(current, struct frame, list_elem);
     ASSERT(frame);
+
+    // The clock hand has come back round to a victim
+    if (lock_held_by_current_thread(&frame->user_pages_lock)) {
+      break;
+    }
     lock_acquire(&frame->user_pages_lock);
 
-    // If all processes that had access to frame have exited, return frame without writing it to swap
-    if (list_size(&frame->user_pages) == 0) {
+    // A frame with no user_pages is either free or still being set up by frame_insert, so it can't be evicted
+    if (list_empty(&frame->user_pages)) {
+      lock_release(&frame->user_pages_lock);
+    } else if (frame->pinned || !policy->select(frame)) {
       lock_release(&frame->user_pages_lock);
-      return frame;
+    } else {
+      // Keeps the lock on user_pages until the frame has been written to swap
+      victims[victim_cnt++] = frame;
     }
 
-    // Need to check all pages mapped to frame in case frame is shared
-    user_pages = &frame->user_pages;
-    bool save = at_least_one_accessed_or_dirty(user_pages);
+    current = advance_clock(current);
+    if (policy->advance != NULL) {
+      policy->advance();
+    }
+    if (victim_cnt > 0) {
+      scan_cnt--;
+    } else if (--budget == 0) {
+      lock_release(&evict_lock);
+      return NULL;
+    }
+  } while (victim_cnt < SWAP_CLUSTER && scan_cnt > 0);
 
-    if (save || frame->pinned)
-    {
-      reset_pagedirs_of_user_pages(user_pages);
+  // Victims that can't be read back from a file
+  struct frame *to_swap[SWAP_CLUSTER];
+  size_t swap_cnt = 0;
 
-      lock_acquire(&frame_table.lock);
+  for (size_t i = 0; i < victim_cnt; i++) {
+    // The frame will hold another page, so it can't be shared as an executable page anymore. Its entry is dropped from the cache when next looked up.
+    victims[i]->exe_cached = false;
+    // Marks the frame as not present and makes the next access to it fault for each process that has access to the frame. However, preserves the refernce to this frame in the page tables.
+    clear_pages_of_user_pages(&victims[i]->user_pages);
 
-      next = list_next(current);
-      if (is_tail(next))
-      {
-        current = list_front(&frame_table.list);
-      } else{
-        current = next;
-      }
-      frame_table.current = current;
+    if (!evict_to_file(victims[i])) {
+      to_swap[swap_cnt++] = victims[i];
+    }
+  }
 
-      lock_release(&frame_table.lock);
-      lock_release(&frame->user_pages_lock);
+	// Allocate swap slots for the pages, panic if none left
+  write_swap_cluster(to_swap, swap_cnt);
+
+  evict_cnt += victim_cnt;
+  for (size_t i = 0; i < victim_cnt; i++) {
+    lock_release(&victims[i]->user_pages_lock);
+    // Only the first victim is handed out here. The others are freed for later allocations, keeping their struct frame for reuse.
+    if (i > 0) {
+      palloc_free_page(victims[i]->address);
     }
-    else
-    {
-      break;
+  }
+  lock_release(&evict_lock);
+  return victims[0];
+}
+
+// Second chance: a frame is evicted unless one of its pages has been accessed since the hand last passed it.
+static bool
+clock_select (struct frame *frame)
+{
+  // Need to check all pages mapped to frame in case frame is shared
+  if (at_least_one_accessed(&frame->user_pages)) {
+    reset_accessed_bits_of_user_pages(&frame->user_pages);
+    return false;
+  }
+  return true;
+}
+
+// Two-handed clock: the front hand clears the accessed bits HAND_SPREAD frames ahead of the back hand, which evicts the frames that haven't been accessed since.
+// Unlike second chance, a frame only survives if it was used in the short time between the two hands, rather than in a whole round of the clock.
+static bool
+two_handed_select (struct frame *frame)
+{
+  return !at_least_one_accessed(&frame->user_pages);
+}
+
+static void
+two_handed_advance (void)
+{
+  lock_acquire(&frame_table.lock);
+  if (front_hand == NULL) {
+    size_t spread = frame_table.frame_cnt / 2;
+    if (spread > HAND_SPREAD) {
+      spread = HAND_SPREAD;
     }
-  } while (true);
-  
-	// Allocate swap slot for page panic if none left
-  ASSERT(write_swap_slot(frame));
+    front_hand = frame_table.current;
+    while (spread-- > 0) {
+      front_hand = clock_next(front_hand);
+    }
+  }
+  front_hand = clock_next(front_hand);
+  lock_release(&frame_table.lock);
 
-  // Marks the frame as not present and makes the next access to it fault for each process that has access to the frame. However, preserves the refernce to this frame in the page tables.
-  clear_pages_of_user_pages(user_pages);
+  struct frame *frame = list_entry(front_hand, struct frame, list_elem);
+  // The front hand has come round to one of the victims
+  if (lock_held_by_current_thread(&frame->user_pages_lock)) {
+    return;
+  }
+  lock_acquire(&frame->user_pages_lock);
+  reset_accessed_bits_of_user_pages(&frame->user_pages);
   lock_release(&frame->user_pages_lock);
-  return frame;
+}
+
+// Simplified CLOCK-Pro. A newly loaded page is cold, and is only promoted to hot if it is accessed again after the hand has passed it once (its test period); cold pages that aren't are evicted.
+// Hot pages that the hand finds unaccessed are demoted to cold, which gives them one more round before eviction. A sequential scan touches each page only once, so it can't push hot pages out.
+// The non-resident test pages of the full algorithm are not kept.
+static bool
+clock_pro_select (struct frame *frame)
+{
+  bool accessed = at_least_one_accessed(&frame->user_pages);
+  reset_accessed_bits_of_user_pages(&frame->user_pages);
+
+  switch (frame->temp) {
+    case COLD_NEW:
+      // The page was accessed when it was loaded, so the bit says nothing yet
+      frame->temp = COLD_TESTED;
+      return false;
+    case COLD_TESTED:
+      if (accessed) {
+        frame->temp = HOT;
+        return false;
+      }
+      return true;
+    case HOT:
+      if (!accessed) {
+        frame->temp = COLD_TESTED;
+      }
+      return false;
+  }
+  NOT_REACHED ();
+}
+
+static void
+clock_pro_insert (struct frame *frame)
+{
+  frame->temp = COLD_NEW;
+}
+
+// Selects the replacement policy called name. Returns false if there isn't one.
+bool
+frame_set_policy (const char *name)
+{
+  for (size_t i = 0; i < sizeof policies / sizeof *policies; i++) {
+    if (!strcmp(policies[i].name, name)) {
+      policy = &policies[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+// Prints frame table statistics
+void
+frame_print_stats (void)
+{
+  printf ("Frames: %s replacement, %llu evictions\n", policy->name, evict_cnt);
+}
+
+// Page-out daemon. Woken up by frame_insert when fewer than FREE_FRAMES_LOW user frames are free, and evicts until FREE_FRAMES_HIGH are free again, so that page faults normally find a free frame without having to evict.
+static void
+kswapd (void *aux UNUSED)
+{
+  for (;;) {
+    sema_down(&kswapd_sema);
+
+    while (palloc_user_free_cnt() < FREE_FRAMES_HIGH) {
+      struct frame *frame = evict();
+      if (frame == NULL) {
+        break;
+      }
+      palloc_free_page(frame->address);
+    }
+  }
+}
+
+// Starts the page-out daemon. Must be called after the swap table has been set up.
+void
+kswapd_init (void)
+{
+  thread_create("kswapd", PRI_DEFAULT, kswapd, NULL);
+}
+
+struct lock *get_user_page_map_lock (void) {
+  return &user_page_map_lock;
 }
 
 struct frametable *get_frame_table (void) {
   return &frame_table;
 }
 
-struct list *get_all_user_pages (void) {
-  return &all_user_pages;
+void *get_zero_page (void) {
+  return zero_page;
 }
 
-struct lock *get_all_user_pages_lock (void) {
-  return &all_user_pages_lock;
+// Drops the page at upage from pd as if it had been evicted, freeing its frame unless other processes still map it. Used by madvise.
+// Only pages that can be read back without swap are dropped: clean pages read from a file, dirty pages of file mappings after writing them back, and zero page mappings. Returns true if the page was dropped.
+bool drop_page (uint32_t *pd, void *upage) {
+  // Keeps the frame from being evicted under us
+  lock_acquire(&evict_lock);
+
+  void *kpage = pagedir_get_page(pd, upage);
+  if (kpage != NULL && kpage == zero_page) {
+    pagedir_clear_page(pd, upage);
+    lock_release(&evict_lock);
+    return true;
+  }
+
+  struct frame *frame = kpage != NULL ? lookup_frame(kpage) : NULL;
+  if (frame == NULL) {
+    lock_release(&evict_lock);
+    return false;
+  }
+
+  lock_acquire(&frame->user_pages_lock);
+  bool dirty = pagedir_is_dirty(pd, upage);
+  bool droppable = !frame->pinned && frame->file != NULL && (!dirty || frame->file_writeback);
+  if (droppable) {
+    if (dirty) {
+      file_write_at(frame->file, kpage, frame->file_bytes, frame->file_ofs);
+      pagedir_set_dirty(pd, upage, false);
+    }
+    pagedir_clear_page(pd, upage);
+  }
+  lock_release(&frame->user_pages_lock);
+
+  if (droppable) {
+    remove_user_page(pd, upage);
+    free_frame(kpage);
+  }
+
+  lock_release(&evict_lock);
+  return droppable;
+}
+
+// Adds user_page to the reverse map. Returns false if its (pd, uaddr) already has a user_page.
+bool add_user_page (struct user_page *user_page) {
+  lock_acquire(&user_page_map_lock);
+  struct hash_elem *old = hash_insert(&user_page_map, &user_page->map_elem);
+  lock_release(&user_page_map_lock);
+  return old == NULL;
+}
+
+// Returns the user_page that UADDR is mapped to in PD, or NULL if there is none. Works for pages in frames and in swap.
+struct user_page *lookup_user_page (uint32_t *pd, const void *uaddr) {
+  struct user_page dummy_page;
+  dummy_page.pd = pd;
+  dummy_page.uaddr = pg_round_down(uaddr);
+
+  lock_acquire(&user_page_map_lock);
+  struct hash_elem *e = hash_find(&user_page_map, &dummy_page.map_elem);
+  lock_release(&user_page_map_lock);
+
+  return e != NULL ? hash_entry(e, struct user_page, map_elem) : NULL;
+}
+
+// Returns the swap slot holding the page UADDR is mapped to in PD, with the slot's lock held, or NULL if the page isn't in swap.
+// user_page_map_lock is held until the slot is locked, and delete_swap_slot takes it before freeing a slot, so the slot can't be freed in between. Once locked, the slot is checked to still hold the page, as another process sharing it may have read it back in the meantime.
+struct swap_slot *lock_swap_slot (uint32_t *pd, const void *uaddr) {
+  struct user_page dummy_page;
+  dummy_page.pd = pd;
+  dummy_page.uaddr = pg_round_down(uaddr);
+  struct swap_slot *swap_slot = NULL;
+
+  lock_acquire(&user_page_map_lock);
+  struct hash_elem *e = hash_find(&user_page_map, &dummy_page.map_elem);
+  if (e != NULL) {
+    struct user_page *user_page = hash_entry(e, struct user_page, map_elem);
+    if (user_page->used_in == SWAP) {
+      swap_slot = user_page->frame_or_swap_slot_ptr;
+      lock_acquire(&swap_slot->lock);
+      if (user_page->used_in != SWAP || user_page->frame_or_swap_slot_ptr != swap_slot) {
+        lock_release(&swap_slot->lock);
+        swap_slot = NULL;
+      }
+    }
+  }
+  lock_release(&user_page_map_lock);
+
+  return swap_slot;
 }
 
 // Used for user memory access in syscall handler
@@ -247,8 +722,7 @@ bool unpin_frame (void *address) {
 }
 
 // Resets accessed bits for one frame
-void reset_accessed_bits (struct hash_elem *e, void *aux UNUSED){
-  struct frame *f = hash_entry(e, struct frame, elem);
+void reset_accessed_bits (struct frame *f){
   struct list *user_pages = &f->user_pages;
 
   lock_acquire(&f->user_pages_lock);
@@ -258,65 +732,78 @@ void reset_accessed_bits (struct hash_elem *e, void *aux UNUSED){
 
 // Resets accessed bits for all frames in frametable
 void reset_all_accessed_bits(void){
-  hash_apply (&frame_table.table, reset_accessed_bits);
+  for (size_t i = 0; i < frame_table.frame_cnt; i++) {
+    reset_accessed_bits(&frame_table.frames[i]);
+  }
 }
 
-// Frees user_page regardless of whether it is currently in frame or in swap_slot
-void remove_user_page (void *kpage, void *pd) {
-  struct list_elem *e;
+// Frees the user_page that UADDR is mapped to in PD, regardless of whether it is currently in frame or in swap_slot. Returns false if there is none.
+bool remove_user_page (uint32_t *pd, const void *uaddr) {
+  struct user_page dummy_page;
+  dummy_page.pd = pd;
+  dummy_page.uaddr = pg_round_down(uaddr);
 
-  lock_acquire(&all_user_pages_lock);
+  lock_acquire(&user_page_map_lock);
+  struct hash_elem *e = hash_delete(&user_page_map, &dummy_page.map_elem);
+  lock_release(&user_page_map_lock);
 
-  // Iterate through all user_page structs in OS
-  for (e = list_begin (&all_user_pages); e != list_end (&all_user_pages); e = list_next (e)) {
-    struct user_page *user_page = list_entry (e, struct user_page, allelem);
+  if (e == NULL) {
+    return false;
+  }
+  struct user_page *user_page = hash_entry(e, struct user_page, map_elem);
 
-    if (user_page->pd == pd 
-    && kpage == pagedir_get_page(pd, user_page->uaddr)) {
-      // Remove from list all_user_pages
-      list_remove(e);
-      lock_release(&all_user_pages_lock);
+  // Remove from frame or swap_slot
+  // Remove swap slot if user_page was embedded in it and if no other processes have reference to that swap_slot.
+  // If user_page was embedded in frame, we don't have to do anything else. The frame will simply be reused earlier in evict function.
+  if (user_page->used_in == SWAP) {
+    struct swap_slot *swap_slot = user_page->frame_or_swap_slot_ptr;
 
-      // Remove from frame or swap_slot
-      list_remove(&user_page->elem);
-      // Remove swap slot if user_page was embedded in it and if no other processes have reference to that swap_slot.
-      // If user_page was embedded in frame, we don't have to do anything. The frame will simply be reused earlier in evict function.
-      if (user_page->used_in == SWAP) {
-        struct swap_slot *swap_slot = user_page->frame_or_swap_slot_ptr;
+    lock_acquire(&swap_slot->lock);
+    list_remove(&user_page->elem);
+    bool unused = list_empty(&swap_slot->user_pages);
+    lock_release(&swap_slot->lock);
 
-        lock_acquire(&swap_slot->lock);
-        if (list_size(&swap_slot->user_pages) == 0) {
-          delete_swap_slot(swap_slot);
-        }
-        lock_release(&swap_slot->lock);
-      }
-      free(user_page);
-      return;
+    if (unused) {
+      delete_swap_slot(swap_slot);
     }
-  }
-
-  lock_release(&all_user_pages_lock);
+  } else {
+    struct frame *frame = user_page->frame_or_swap_slot_ptr;
 
-  PANIC ("Didn't find matching user page");
+    lock_acquire(&frame->user_pages_lock);
+    list_remove(&user_page->elem);
+    lock_release(&frame->user_pages_lock);
+  }
+  free(user_page);
+  return true;
 }
 
 void remove_all_frames (void) {
-  hash_destroy(&frame_table.table, frame_destroy);
+  size_t table_pages = DIV_ROUND_UP(frame_table.frame_cnt * sizeof(struct frame), PGSIZE);
+  palloc_free_multiple(frame_table.frames, table_pages);
 }
 
 // Used in eviction. Must be called with lock on user_pages list.
-static bool at_least_one_accessed_or_dirty (struct list *user_pages) {
+// Dirty bits are not looked at here: they decide where an evicted page is written, not whether it's evicted.
+static bool at_least_one_accessed (struct list *user_pages) {
   struct list_elem *e;
   for (e = list_begin (user_pages); e != list_end (user_pages); e = list_next (e)) {
     struct user_page *user_page = list_entry(e, struct user_page, elem);
-    const void *uaddr = user_page->uaddr;
-    uint32_t *pd = user_page->pd;
 
-    bool accessed = pagedir_is_accessed(pd,uaddr);
-    bool dirty = pagedir_is_dirty(pd,uaddr);
-    bool save = (accessed || dirty);
+    if (pagedir_is_accessed(user_page->pd, user_page->uaddr)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Used in eviction. Must be called with lock on user_pages list.
+static bool at_least_one_dirty (struct list *user_pages) {
+  struct list_elem *e;
+  for (e = list_begin (user_pages); e != list_end (user_pages); e = list_next (e)) {
+    struct user_page *user_page = list_entry(e, struct user_page, elem);
 
-    if (save) {
+    if (pagedir_is_dirty(user_page->pd, user_page->uaddr)) {
       return true;
     }
   }
@@ -324,9 +811,51 @@ static bool at_least_one_accessed_or_dirty (struct list *user_pages) {
   return false;
 }
 
+// Used in eviction. Evicts a frame whose page can be read back from its file instead of from swap: a dirty page of a file mapping is written back to the file first, and a clean page is simply dropped.
+// The user_pages are freed, so the next access faults and attempt_load_pages reads the page from its file again. Returns false if the page has to go to swap.
+// Must be called with lock on user_pages list, after the pages have been cleared.
+static bool evict_to_file (struct frame *frame) {
+  // user_pages that are being freed by remove_user_page
+  struct list removed;
+
+  if (frame->file == NULL) {
+    return false;
+  }
+
+  if (at_least_one_dirty(&frame->user_pages)) {
+    if (!frame->file_writeback) {
+      return false;
+    }
+    file_write_at(frame->file, frame->address, frame->file_bytes, frame->file_ofs);
+    clear_dirty_bits_of_user_pages(&frame->user_pages);
+  }
+
+  list_init(&removed);
+  while (!list_empty (&frame->user_pages)) {
+    struct user_page *user_page = list_entry(list_pop_front (&frame->user_pages), struct user_page, elem);
+
+    lock_acquire(&user_page_map_lock);
+    struct hash_elem *e = hash_delete(&user_page_map, &user_page->map_elem);
+    lock_release(&user_page_map_lock);
+
+    // Otherwise remove_user_page has taken the user_page out of the map, and will free it once it gets the lock on user_pages
+    if (e != NULL) {
+      free(user_page);
+    } else {
+      list_push_back(&removed, &user_page->elem);
+    }
+  }
+
+  // Puts back the user_pages that remove_user_page is freeing, since it takes them out of the frame's list
+  while (!list_empty (&removed)) {
+    list_push_back(&frame->user_pages, list_pop_front (&removed));
+  }
+  return true;
+}
+
 // Used in eviction.
-static void reset_pagedirs_of_user_pages (struct list *user_pages) {
-  user_pages_forall(user_pages, pagedir_reset);
+static void clear_accessed_bit (uint32_t *pd, void *uaddr) {
+  pagedir_set_accessed(pd, uaddr, false);
 }
 
 // Used in eviction.
@@ -336,7 +865,17 @@ static void clear_pages_of_user_pages (struct list *user_pages) {
 
 // Used in eviction.
 static void reset_accessed_bits_of_user_pages (struct list *user_pages) {
-  user_pages_forall(user_pages, reset_accessed_bits);
+  user_pages_forall(user_pages, clear_accessed_bit);
+}
+
+// Used in eviction.
+static void clear_dirty_bit (uint32_t *pd, void *uaddr) {
+  pagedir_set_dirty(pd, uaddr, false);
+}
+
+// Used in eviction. The pages have been written back, so writing back their file mapping mustn't write them again.
+static void clear_dirty_bits_of_user_pages (struct list *user_pages) {
+  user_pages_forall(user_pages, clear_dirty_bit);
 }
 
 // Helper function
@@ -1,12 +1,35 @@
 #ifndef VM_FRAME_H
 #define VM_FRAME_H
 #include <inttypes.h>
+#include <stddef.h>
 #include "lib/kernel/hash.h"
 #include "threads/synch.h"
+#include "devices/block.h"
+#include "filesys/off_t.h"
 #include <hash.h>
 
+struct file;
+struct swap_slot;
+
+// The page-out daemon is woken up when fewer than FREE_FRAMES_LOW user frames are free, and evicts until FREE_FRAMES_HIGH are free
+#define FREE_FRAMES_LOW 16
+#define FREE_FRAMES_HIGH 32
+
+// Maximum distance between the hands of the two-handed clock
+#define HAND_SPREAD 64
+
 typedef void pagedir_generic_function (uint32_t *pd, void *vpage);
 
+// Replacement state of a frame under the "clockpro" policy (see frame.c)
+enum frame_temp {
+  // Cold page that the clock hand hasn't passed since it was loaded
+  COLD_NEW,
+  // Cold page that is evicted unless it is accessed before the hand comes round again
+  COLD_TESTED,
+  // Page that has been accessed again after its test period
+  HOT
+};
+
 // Represents struct that user_page is pointing to
 enum used_in {
   FRAME,
@@ -17,7 +40,12 @@ enum used_in {
 struct frametable
 {
   struct list list;   //List for cicular queue of elements
-  struct hash table;  //Hash table fot looking up elements
+  // One frame per page of the user pool, indexed by the page's position in the pool (see lookup_frame)
+  struct frame *frames;
+  // Start of the user pool
+  void *base;
+  // Number of pages in the user pool
+  size_t frame_cnt;
   struct list_elem *current;
   // Lock on frametable
   struct lock lock;
@@ -30,7 +58,6 @@ struct frame
   // Not used
   int size;
 
-  struct hash_elem elem;   //Elem to be part of frame table
   // For putting frame in frametable.list
   struct list_elem list_elem;
 
@@ -43,10 +70,39 @@ struct frame
   struct list user_pages;
   // Lock for list user_pages
   struct lock user_pages_lock;
+
+  // Shared executable pages
+
+  // True if frame holds the read-only executable page at (exe_sector, exe_ofs, exe_read_bytes), which any process running the executable can map
+  bool exe_cached;
+  // True if exe_elem is in the executable page cache. It is left there when the frame is evicted, until it is looked up or the frame is cached again.
+  bool exe_in_hash;
+  // Sector of the executable's inode
+  block_sector_t exe_sector;
+  // Offset of the page within the executable
+  off_t exe_ofs;
+  // Number of bytes of the page read from the executable. The rest is zeros, so segments sharing a file page may hold different pages.
+  uint32_t exe_read_bytes;
+  // Elem for adding to executable page cache (defined in frame.c)
+  struct hash_elem exe_elem;
+
+  // File backing
+
+  // File the frame's page was read from, and can be read from again if it's evicted. NULL if the page only exists in memory (stack, copied or swapped in pages).
+  struct file *file;
+  // Offset of the page within file
+  off_t file_ofs;
+  // Number of bytes of the page read from file
+  uint32_t file_bytes;
+  // True if the page belongs to a file mapping, so it is written back to file when evicted dirty
+  bool file_writeback;
+
+  // Used by the "clockpro" replacement policy
+  enum frame_temp temp;
 };
 
 // Holds data about page that is mapped to frame. Is needed for sharing.
-// Note: due to extensive use of struct user_page it would be significantly better if lists holding user_pages were hashmaps instead with the following key: (uint32_t *pd, void *uaddr)
+// Every user_page is also kept in a global hash map keyed by (pd, uaddr), so the page a process maps at an address can be found without scanning (see lookup_user_page).
 struct user_page {
   // Page directory
   uint32_t *pd;
@@ -54,8 +110,8 @@ struct user_page {
   void *uaddr;
   // Shared elem for adding to list users_list in frame and in swap_slot
   struct list_elem elem;
-  // Elem used for adding to static list user_pages (defined in frame.c)
-  struct list_elem allelem;
+  // Elem used for adding to static hash map user_page_map (defined in frame.c)
+  struct hash_elem map_elem;
   // Parent struct; either frame or swap
   enum used_in used_in;
   // Pointer to the struct to which user_page belongs, so either frame or swap_slot. Useful for sharing.
@@ -64,22 +120,36 @@ struct user_page {
 
 void* frame_insert (void *kpage, uint32_t *pd, void *vaddr, int size);
 struct frame *lookup_frame(void *kpage);
+void alloc_frame_table (void *base, size_t page_cnt);
 void init_frame_table(void);
 struct frame *find_frame (void *address);
 void *get_frame (uint32_t *pd, void *vaddr);
 
 struct frametable *get_frame_table (void);
-struct list *get_all_user_pages (void);
-struct lock *get_all_user_pages_lock (void);
+void *get_zero_page (void);
+bool drop_page (uint32_t *pd, void *upage);
+bool add_user_page (struct user_page *user_page);
+struct user_page *lookup_user_page (uint32_t *pd, const void *uaddr);
+struct swap_slot *lock_swap_slot (uint32_t *pd, const void *uaddr);
+struct lock *get_user_page_map_lock (void);
 
 bool pin_frame (void *address);
 bool unpin_frame (void *address);
 
 void reset_all_accessed_bits(void);
-void reset_accessed_bits (struct hash_elem *e, void *aux);
+void reset_accessed_bits (struct frame *f);
 
-void remove_user_page (void *kpage, void *pd);
+bool remove_user_page (uint32_t *pd, const void *uaddr);
 void remove_all_frames (void);
-void free_frames(void* pages, size_t page_cnt);
+void free_frame (void *kpage);
+
+bool share_exe_page (struct file *file, off_t ofs, uint32_t read_bytes, void *upage);
+void cache_exe_frame (void *kpage, struct file *file, off_t ofs, uint32_t read_bytes);
+void set_frame_file (void *kpage, struct file *file, off_t ofs, uint32_t bytes, bool writeback);
+
+void kswapd_init (void);
+
+bool frame_set_policy (const char *name);
+void frame_print_stats (void);
 
 #endif
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include "userprog/pagedir.h"
 #include "userprog/syscall.h"
 #include "vm/page.h"
+#include "vm/frame.h"
 #include <stdio.h>
 #include "filesys/file.h"
 
@@ -32,6 +33,7 @@ mmap_add_mapping (int fd, int pgcnt, void *uaddr)
   mapping->fd = fd;
   mapping->pgcnt = pgcnt;
   mapping->uaddr = uaddr;
+  mapping->owner = thread_current()->tid;
 
   lock_acquire(&map_list_lock);
   list_push_back(&map_list, &mapping->map_list_elem);
@@ -41,6 +43,84 @@ mmap_add_mapping (int fd, int pgcnt, void *uaddr)
   return mapping->mapid;
 }
 
+// Writes the dirty pages of mapping back to file, each at its own offset in the file and no further than the end of the file. Runs of adjacent dirty pages are written with a single write.
+// The pages are clean afterwards, so a later writeback only writes what has changed since.
+static void
+write_back_dirty_pages (struct mapped_file *mapping, struct file *file)
+{
+  uint32_t *pd = thread_current()->pagedir;
+  off_t length = file_length(file);
+  int i = 0;
+
+  while (i < mapping->pgcnt) {
+    if (!pagedir_is_dirty(pd, mapping->uaddr + PGSIZE * i)) {
+      i++;
+      continue;
+    }
+
+    int run_start = i;
+    while (i < mapping->pgcnt && pagedir_is_dirty(pd, mapping->uaddr + PGSIZE * i)) {
+      i++;
+    }
+
+    off_t start = run_start * PGSIZE;
+    off_t end = i * PGSIZE;
+    if (end > length) {
+      end = length;
+    }
+    if (start >= end) {
+      continue;
+    }
+
+    // Keeps the pages in memory while the file system reads them. They are only marked clean once written, so that eviction in the meantime still writes them back.
+    void *run_addr = mapping->uaddr + start;
+    pin_obj(run_addr, end - start);
+    file_write_at(file, run_addr, end - start, start);
+    for (int j = run_start; j < i; j++) {
+      pagedir_set_dirty(pd, mapping->uaddr + PGSIZE * j, false);
+    }
+    unpin_obj(run_addr, end - start);
+  }
+}
+
+// Returns the current process's mapping with id mapid, or NULL if there is none
+static struct mapped_file *
+lookup_mapping (mapid_t mapid)
+{
+  struct mapped_file *found = NULL;
+  struct list_elem *e;
+
+  lock_acquire(&map_list_lock);
+  for (e = list_begin(&map_list); e != list_end(&map_list); e = list_next(e)) {
+    struct mapped_file *mapping = list_entry(e, struct mapped_file, map_list_elem);
+    if (mapping->mapid == mapid && mapping->owner == thread_current()->tid) {
+      found = mapping;
+      break;
+    }
+  }
+  lock_release(&map_list_lock);
+
+  return found;
+}
+
+// Writes the dirty pages of mapping mapid back to its file. Returns false if the current process has no such mapping.
+bool
+mmap_sync_mapping (mapid_t mapid)
+{
+  struct mapped_file *mapping = lookup_mapping(mapid);
+  if (mapping == NULL) {
+    return false;
+  }
+
+  struct file *file = spt_mmap_file(mapping->uaddr);
+  if (file == NULL) {
+    return false;
+  }
+
+  write_back_dirty_pages(mapping, file);
+  return true;
+}
+
 // Removes mapping of file
 bool
 mmap_remove_mapping (mapid_t mapid)
@@ -56,30 +136,30 @@ mmap_remove_mapping (mapid_t mapid)
 
     if (mapping->mapid == mapid)
     {
-      // TODO: use spt_removal_success to determine return value of mmap_remove_mapping
-      bool spt_removal_success = spt_remove_mmap_file(mapping->uaddr);
-
-      acquire_filesystem_lock();
-      struct file *file = get_file_or_null(mapping->fd);
+      // The file's descriptor may have been closed, so the range's own file is used
+      struct file *file = spt_mmap_file(mapping->uaddr);
       uint32_t *pd = thread_current()->pagedir;
       ASSERT(file);
-      file_seek(file, 0);
+
+      write_back_dirty_pages(mapping, file);
   
       for (int i = 0; i < mapping->pgcnt; i++) {
         void *pgaddr = mapping->uaddr + PGSIZE * i;
-        if (pagedir_is_dirty(pd, pgaddr)) {
-          file_write(file, pgaddr, file_length(file));
-        } else {
-          file_seek(file, file_tell(file) + PGSIZE);
-        }
 
-        // Removes frame
-        palloc_free_page(pagedir_get_page(pd, pgaddr));
+        // Removes page from the reverse map, along with its swap slot if it was swapped out
+        remove_user_page(pd, pgaddr);
+        // Removes frame, unless another process shares it
+        void *kpage = pagedir_get_page(pd, pgaddr);
+        if (kpage != NULL) {
+          free_frame(kpage);
+        }
         // Removes mapping from user address to frame
         pagedir_clear_page(pd, pgaddr);
       }
-      file_seek(file, 0);
-      release_filesystem_lock();
+
+      // The range's file is closed with it, so this is done once no frame can be written back to it
+      // TODO: use spt_removal_success to determine return value of mmap_remove_mapping
+      bool spt_removal_success = spt_remove_mmap_file(mapping->uaddr);
     
       // Removes element from map_list
       lock_acquire(&map_list_lock);
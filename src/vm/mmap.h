@@ -2,6 +2,7 @@
 #define VM_MMAP_H
 
 #include "lib/user/syscall.h"
+#include "threads/thread.h"
 #include <list.h>
 
 // Map a mapid_t to a struct mapped_file
@@ -11,12 +12,14 @@ struct mapped_file {
   int fd;                         /* File descriptor of the file opened */
   int pgcnt;                      /* Number of continuous pages */
   void *uaddr;                    /* Address given in syscall */
+  tid_t owner;                    /* Thread of the process that made the mapping */
   struct list_elem map_list_elem; /* Element in the list of mappings */
 };
 
 void mmap_init(void);
 mapid_t mmap_add_mapping(int fd, int pgcnt, void *uaddr);
 bool mmap_remove_mapping(mapid_t mapid);
+bool mmap_sync_mapping(mapid_t mapid);
 void remove_all_mappings (void);
 
 #endif
\ No newline at end of file
@@ -9,205 +9,539 @@
 #include "threads/synch.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include <bitmap.h>
 #include "lib/string.h"
 #include "userprog/pagedir.h"
 #include "vm/frame.h"
 #include "userprog/exception.h"
+#include <syscall-nr.h>
 
 static bool pin_or_unpin_obj (void *uaddr, int size, pin_or_unpin_frame *);
 
+// Creates a range of PAGE_CNT pages starting at UPAGE, none of which have been loaded yet
+// A FILE range gets its own reopened FILE, since frames read from it write back through it (see set_frame_file) and may outlive the process's file descriptor.
+struct spt_range *spt_range_create (enum data_type type, struct file *file, off_t ofs, void *upage, size_t page_cnt, uint32_t read_bytes, bool writable) {
+  struct spt_range *range = malloc(sizeof(struct spt_range));
+  if (range == NULL) {
+    PANIC ("Could not malloc spt_range in page.c: spt_range_create");
+  }
+
+  range->type = type;
+  range->file = file;
+  if (type == FILE) {
+    range->file = file_reopen(file);
+    if (range->file == NULL) {
+      PANIC ("Could not reopen file in page.c: spt_range_create");
+    }
+  }
+  range->ofs = ofs;
+  range->upage = upage;
+  range->page_cnt = page_cnt;
+  range->read_bytes = read_bytes;
+  range->writable = writable;
+  range->loaded = NULL;
+  range->next_fault_idx = 0;
+  range->fault_around = 0;
+  range->advice = MADV_NORMAL;
+  range->drop_idx = 0;
+
+  if (type != STACK) {
+    range->loaded = bitmap_create(page_cnt);
+    if (range->loaded == NULL) {
+      PANIC ("Could not malloc bitmap in page.c: spt_range_create");
+    }
+  }
+
+  return range;
+}
+
+void spt_range_destroy (struct spt_range *range) {
+  if (range->type == FILE) {
+    file_close(range->file);
+  }
+  bitmap_destroy(range->loaded);
+  free(range);
+}
+
+// Returns number of bytes to read from file into page IDX of range
+uint32_t spt_range_read_bytes (const struct spt_range *range, size_t idx) {
+  uint32_t start = idx * PGSIZE;
+  if (range->read_bytes <= start) {
+    return 0;
+  }
+  return range->read_bytes - start < PGSIZE ? range->read_bytes - start : PGSIZE;
+}
+
+// Returns the range that holds uaddr, or NULL if there is none. Must be called with lock on spt's ranges.
+struct spt_range *spt_find_range (struct spt *spt, const void *uaddr) {
+  struct list_elem *e;
+
+  for (e = list_begin (&spt->ranges); e != list_end (&spt->ranges); e = list_next (e)) {
+    struct spt_range *range = list_entry (e, struct spt_range, elem);
+
+    if ((uint8_t *) uaddr < range->upage) {
+      // Ranges are sorted, so none of the rest can hold uaddr
+      break;
+    }
+    if ((uint8_t *) uaddr < range->upage + range->page_cnt * PGSIZE) {
+      return range;
+    }
+  }
+  return NULL;
+}
+
+static bool
+range_less (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED)
+{
+  return list_entry(a, struct spt_range, elem)->upage
+         < list_entry(b, struct spt_range, elem)->upage;
+}
+
+// Adds range to spt, keeping ranges sorted. Must be called with lock on spt's ranges.
+void spt_insert_range (struct spt *spt, struct spt_range *range) {
+  list_insert_ordered(&spt->ranges, &range->elem, range_less, NULL);
+}
+
 bool
 spt_contains_uaddr(void *upage)
 {
+  return spt_overlaps(upage, 1);
+}
+
+// Returns true if page idx of range is in memory or in swap, so it must not be read from the file.
+// A page that has been loaded may have been dropped by eviction since, in which case it no longer has a user_page. Pages mapped to the zero page never have one.
+bool spt_range_page_present (struct spt_range *range, size_t idx) {
+  uint32_t *pd = thread_current()->pagedir;
+  void *upage = range->upage + idx * PGSIZE;
+
+  return bitmap_test(range->loaded, idx) &&
+         (lookup_user_page(pd, upage) != NULL || pagedir_get_page(pd, upage) == get_zero_page());
+}
+
+// Reads page idx of range from its file.
+// A page that is all zeros is mapped to the shared zero page unless write is true; it gets its own frame on the first write (see copy_on_write).
+bool spt_range_load_page (struct spt_range *range, size_t idx, bool write) {
+  uint32_t *pd = thread_current()->pagedir;
+  uint32_t read_bytes = spt_range_read_bytes(range, idx);
+  off_t ofs = range->ofs + idx * PGSIZE;
+  void *upage = range->upage + idx * PGSIZE;
+
+  if (read_bytes == 0 && !write) {
+    bool mapped = pagedir_set_page(pd, upage, get_zero_page(), false);
+    bitmap_set(range->loaded, idx, mapped);
+    return mapped;
+  }
+
+  bool loaded = load_page(range->file, ofs, upage, read_bytes, PGSIZE - read_bytes, range->writable);
+  bitmap_set(range->loaded, idx, loaded);
+
+  // Lets eviction read the page back from the file instead of writing it to swap. Dirty pages of file mappings are written back to the file.
+  if (loaded) {
+    set_frame_file(pagedir_get_page(pd, upage), range->file, ofs, read_bytes, range->type == FILE);
+  }
+  return loaded;
+}
+
+// Checks whether any of the page_cnt pages starting at upage belongs to a range
+bool spt_overlaps (void *upage, size_t page_cnt) {
   struct thread *t = thread_current();
   struct spt *spt = &t->spt;
-  struct list *pages = &spt->pages;
+  uint8_t *start = pg_round_down(upage);
+  uint8_t *end = start + page_cnt * PGSIZE;
+  bool overlaps = false;
 
   struct list_elem *e;
 
-  lock_acquire(&spt->pages_lock);
+  lock_acquire(&spt->ranges_lock);
 
-  // Searches pages for the one we want to remove
-  for (e = list_begin (pages); e != list_end (pages); e = list_next (e)) {
-    struct spt_page *spt_page = list_entry (e, struct spt_page, elem);
+  for (e = list_begin (&spt->ranges); e != list_end (&spt->ranges); e = list_next (e)) {
+    struct spt_range *range = list_entry (e, struct spt_range, elem);
 
-    if (spt_page->upage == upage) {
-      lock_release(&spt->pages_lock);
-      return true;
+    if (range->upage < end && start < range->upage + range->page_cnt * PGSIZE) {
+      overlaps = true;
+      break;
     }
   }
-  lock_release(&spt->pages_lock);
-  return false;
+
+  lock_release(&spt->ranges_lock);
+  return overlaps;
 }
 
 // Adds an entry in SPT when a file is mapped to memory
-// This function must be called after filesystem_lock has been acquired
 void spt_add_mmap_file (struct file *file, void *upage) {
-  struct spt_page *spt_page = malloc(sizeof(struct spt_page));
-  if (spt_page == NULL) {
-    PANIC ("Could not malloc spt_page in page.c: spt_add_mmap_page");
-  }
-
   // Variables passed as arguments to load_segment below
   uint32_t read_bytes = file_length (file);
-  uint32_t zero_bytes = PGSIZE - (read_bytes % PGSIZE);
+  uint32_t zero_bytes = (PGSIZE - (read_bytes % PGSIZE)) % PGSIZE;
   // It is assumed all mapped file pages are writable.
   bool writable = true;
 
-  // Add metadata for each of the file's pages to spt
+  // Add metadata for the file's pages to spt
   load_segment(file, 0, upage, read_bytes, zero_bytes, writable, FILE);
+}
+
+// Returns the file of the range of a file mapped at upage, or NULL if there is none. The range has its own reopened file, which stays open after the process closes the file's descriptor.
+struct file *spt_mmap_file (void *upage) {
+  struct spt *spt = &thread_current()->spt;
+  struct file *file = NULL;
 
-  // Set file's read head back to 0
-  file_seek (file, 0);
+  lock_acquire(&spt->ranges_lock);
+  struct spt_range *range = spt_find_range(spt, upage);
+  if (range != NULL && range->upage == upage && range->type == FILE) {
+    file = range->file;
+  }
+  lock_release(&spt->ranges_lock);
+
+  return file;
 }
 
-// Removes spt_page from list pages in SPT and deallocates spt_page
+// Removes the range of a file mapped at upage from SPT and deallocates it
 bool spt_remove_mmap_file (void *upage) {
   struct thread *t = thread_current();
   struct spt *spt = &t->spt;
-  struct list *pages = &spt->pages;
-
-  struct list_elem *e;
   bool success = false;
 
-  lock_acquire(&spt->pages_lock);
-
-  // Searches pages for the one we want to remove
-  for (e = list_begin (pages); e != list_end (pages); e = list_next (e)) {
-    struct spt_page *spt_page = list_entry (e, struct spt_page, elem);
-
-    if (spt_page->upage == upage) {
-      list_remove(&spt_page->elem);
-      free(spt_page);
-      success = true;
-      break;
-    }
+  lock_acquire(&spt->ranges_lock);
 
+  struct spt_range *range = spt_find_range(spt, upage);
+  if (range != NULL && range->upage == upage && range->type == FILE) {
+    list_remove(&range->elem);
+    spt_range_destroy(range);
+    success = true;
   }
 
-  lock_release(&spt->pages_lock);
+  lock_release(&spt->ranges_lock);
   return success;
 }
 
-// Adds an entry for a stack page to SPT
-void spt_add_stack_page (void *upage) {
+// Reserves the stack pages from upage up to PHYS_BASE in the SPT. Faults on any of them are handled as stack accesses, whether or not the page has been touched yet (see grow_stack).
+// The stack's range only grows down, and is the highest range, as file mappings must lie below the stack limit.
+void spt_reserve_stack (void *upage) {
   struct thread *t = thread_current();
   struct spt *spt = &t->spt;
-  struct list *pages = &spt->pages;
+  size_t page_cnt = ((uint8_t *) PHYS_BASE - (uint8_t *) upage) / PGSIZE;
 
-  struct spt_page *spt_page = malloc(sizeof(struct spt_page));
-  if (spt_page == NULL) {
-    PANIC ("Could not malloc spt_page in page.c: spt_add_mmap_page");
+  lock_acquire(&spt->ranges_lock);
+
+  struct spt_range *stack = NULL;
+  if (!list_empty(&spt->ranges)) {
+    stack = list_entry(list_back(&spt->ranges), struct spt_range, elem);
   }
 
-  spt_page->upage = upage;
-  spt_page->type = STACK;
-  spt_page->loaded = false;
+  if (stack != NULL && stack->type == STACK) {
+    // Still sorted, as the pages below the stack were not in any range
+    if ((uint8_t *) upage < stack->upage) {
+      stack->upage = upage;
+      stack->page_cnt = page_cnt;
+    }
+  } else {
+    stack = spt_range_create(STACK, NULL, 0, upage, page_cnt, 0, true);
+    spt_insert_range(spt, stack);
+  }
+  spt->stack_size = stack->page_cnt * PGSIZE;
 
-  lock_acquire(&spt->pages_lock);
-  list_push_back(pages, &spt_page->elem);
-  lock_release(&spt->pages_lock);
+  lock_release(&spt->ranges_lock);
 }
 
-// Creates a duplicate od spt_page and returns pointer to it. Used for sharing.
-static struct spt_page *cpy_spt_page (struct spt_page *src) {
-  struct spt_page *dest = malloc(sizeof(struct spt_page));
-  if (dest == NULL) {
-    PANIC ("Could not malloc spt_page in page.c: cpy_spt_page");
-  }
-
-  dest->type = src->type;
-  dest->loaded = src->loaded;
-  dest->file = src->file;
-  
-  dest->ofs = src->ofs;
-  dest->upage = src->upage;
-  dest->read_bytes = src->read_bytes;
-  dest->zero_bytes = src->zero_bytes;
-  dest->writable = src->writable;
-
-  return dest;
+// Creates a duplicate of range and returns pointer to it. None of its pages are marked as loaded. Used for sharing.
+static struct spt_range *cpy_spt_range (struct spt_range *src) {
+  return spt_range_create(src->type, src->file, src->ofs, src->upage, src->page_cnt, src->read_bytes, src->writable);
 }
 
-// Copies non-stack parent's spt pages to child's spt. Later, sets up child's pagedir to map pages to the same frames as its parent. Finally, adds references to child in the frame itself via struct user_page.
+// Copies non-stack parent's spt ranges to child's spt. Later, sets up child's pagedir to map the loaded pages to the same frames as its parent. Finally, adds references to child in the frame itself via struct user_page.
+// Pages of writable ranges are shared copy-on-write: they are made read-only in both pagedirs, and the first process to write to one gets its own copy (see copy_on_write).
 void share_pages (struct thread *parent, struct thread *child) {
   struct spt *spt_parent = &parent->spt;
   struct spt *spt_child = &child->spt;
 
-  struct list *parent_pages = &spt_parent->pages;
-  struct list *child_pages = &spt_child->pages;
+  struct list *parent_ranges = &spt_parent->ranges;
 
   struct list_elem *e;
   bool same_executable = strcmp(parent->name, child->name) == 0;
 
-  lock_acquire(&spt_parent->pages_lock);
+  lock_acquire(&spt_parent->ranges_lock);
 
-  for (e = list_begin (parent_pages); e != list_end (parent_pages); e = list_next (e)) {
-    struct spt_page *parent_spt_page = list_entry (e, struct spt_page, elem);
+  for (e = list_begin (parent_ranges); e != list_end (parent_ranges); e = list_next (e)) {
+    struct spt_range *parent_range = list_entry (e, struct spt_range, elem);
 
     // Stack pages are not shared; if parent and child have different executables, don't copy metadata about it
-    if (parent_spt_page->type == STACK ||
-    (!same_executable && parent_spt_page->type == EXECUTABLE)) {
+    if (parent_range->type == STACK ||
+    (!same_executable && parent_range->type == EXECUTABLE)) {
       continue;
     }
 
-    struct spt_page *child_spt_page = cpy_spt_page(parent_spt_page);
+    struct spt_range *child_range = cpy_spt_range(parent_range);
 
-    lock_acquire(&spt_child->pages_lock);
-    list_push_back(child_pages, &child_spt_page->elem);
-    lock_release(&spt_child->pages_lock);
+    lock_acquire(&spt_child->ranges_lock);
+    spt_insert_range(spt_child, child_range);
+    lock_release(&spt_child->ranges_lock);
 
     struct frametable *frame_table = get_frame_table();
 
-    // Need to use a lock here to ensure frame's address doesn't change between call to pagedir_get_page and lookup_frame
-    lock_acquire(&frame_table->lock);
+    for (size_t i = 0; i < child_range->page_cnt; i++) {
+      void *upage = child_range->upage + i * PGSIZE;
+
+      // Need to use a lock here to ensure frame's address doesn't change between call to pagedir_get_page and lookup_frame
+      lock_acquire(&frame_table->lock);
+
+      void *kpage = pagedir_get_page(parent->pagedir, upage);
+      // Pages the parent hasn't loaded, or has swapped out, are loaded by the child itself
+      if (kpage == NULL) {
+        lock_release(&frame_table->lock);
+        continue;
+      }
+      // The zero page is already read-only and has no frame
+      if (kpage == get_zero_page()) {
+        lock_release(&frame_table->lock);
+        install_page(upage, kpage, false);
+        bitmap_mark(child_range->loaded, i);
+        continue;
+      }
+      // A page the parent has written to no longer holds what the child would load, so the child loads its own copy
+      if (pagedir_is_dirty(parent->pagedir, upage)) {
+        lock_release(&frame_table->lock);
+        continue;
+      }
+      // Adds read-only mapping from page to kernel address
+      install_page(upage, kpage, false);
+      if (child_range->writable) {
+        pagedir_set_writable(parent->pagedir, upage, false);
+      }
+      struct frame *shared_frame = lookup_frame(kpage);
+
+      lock_release(&frame_table->lock);
+
+      bitmap_mark(child_range->loaded, i);
 
-    void *kpage = pagedir_get_page(parent->pagedir, child_spt_page->upage);
-    // Adds mapping from page to kernel address
-    install_page(child_spt_page->upage, kpage, child_spt_page->writable);
-    struct frame *shared_frame = lookup_frame(kpage);
+      struct user_page *user_page = malloc(sizeof(struct user_page));
+      if (user_page == NULL) {
+        PANIC ("Malloc failed");
+      }
 
+      user_page->pd = child->pagedir;
+      user_page->uaddr = upage;
+      user_page->frame_or_swap_slot_ptr = shared_frame;
+      user_page->used_in = FRAME;
+
+      // Adds user_page to the reverse map. Useful for easy deallocation of user_page.
+      add_user_page(user_page);
+
+      lock_acquire(&shared_frame->user_pages_lock);
+      list_push_back(&shared_frame->user_pages, &user_page->elem);
+      lock_release(&shared_frame->user_pages_lock);
+    }
+  }
+
+  lock_release(&spt_parent->ranges_lock);
+}
+
+// Gives the current process its own writable copy of the page holding uaddr if the page is shared copy-on-write. If no other process shares the page anymore, it is simply made writable. Returns false if uaddr is not in a copy-on-write page.
+bool copy_on_write (void *uaddr) {
+  struct thread *t = thread_current();
+  struct spt *spt = &t->spt;
+  void *upage = pg_round_down(uaddr);
+
+  lock_acquire(&spt->ranges_lock);
+  struct spt_range *range = spt_find_range(spt, upage);
+  bool writable = range != NULL && range->writable;
+  struct file *file = range != NULL ? range->file : NULL;
+  lock_release(&spt->ranges_lock);
+
+  // Copy-on-write pages belong to writable ranges but are mapped read-only
+  if (!writable || pagedir_is_writable(t->pagedir, upage)) {
+    return false;
+  }
+
+  struct frametable *frame_table = get_frame_table();
+
+  lock_acquire(&frame_table->lock);
+  void *old_kpage = pagedir_get_page(t->pagedir, upage);
+
+  // First write to a zero-fill page
+  if (old_kpage == get_zero_page()) {
     lock_release(&frame_table->lock);
+    void *new_kpage = palloc_get_page_aux(PAL_USER | PAL_ZERO, t->pagedir, upage);
+    pagedir_clear_page(t->pagedir, upage);
+    pagedir_set_page(t->pagedir, upage, new_kpage, true);
+    unpin_frame(new_kpage);
+    return true;
+  }
 
-    struct user_page *user_page = malloc(sizeof(struct user_page));
-    if (user_page == NULL) {
-      PANIC ("Malloc failed");
+  struct frame *old_frame = old_kpage != NULL ? lookup_frame(old_kpage) : NULL;
+  if (old_frame == NULL) {
+    lock_release(&frame_table->lock);
+    return false;
+  }
+  // Keeps the frame from being evicted while it is copied
+  bool pinned = old_frame->pinned;
+  old_frame->pinned = true;
+  lock_release(&frame_table->lock);
+
+  lock_acquire(&old_frame->user_pages_lock);
+  bool shared = list_size(&old_frame->user_pages) > 1;
+  lock_release(&old_frame->user_pages_lock);
+  bool unused = false;
+
+  if (shared) {
+    // The process's user_page already exists, so frame_insert doesn't add one to the new frame. It is moved there below.
+    void *new_kpage = palloc_get_page_aux(PAL_USER, t->pagedir, upage);
+    memcpy(new_kpage, old_kpage, PGSIZE);
+
+    lock_acquire(&frame_table->lock);
+    struct frame *new_frame = lookup_frame(new_kpage);
+    lock_release(&frame_table->lock);
+
+    struct user_page *user_page = lookup_user_page(t->pagedir, upage);
+    ASSERT (user_page != NULL);
+
+    lock_acquire(&old_frame->user_pages_lock);
+    list_remove(&user_page->elem);
+    unused = list_empty(&old_frame->user_pages);
+    lock_release(&old_frame->user_pages_lock);
+
+    lock_acquire(&new_frame->user_pages_lock);
+    user_page->frame_or_swap_slot_ptr = new_frame;
+    list_push_back(&new_frame->user_pages, &user_page->elem);
+    lock_release(&new_frame->user_pages_lock);
+
+    pagedir_clear_page(t->pagedir, upage);
+    pagedir_set_page(t->pagedir, upage, new_kpage, true);
+    unpin_frame(new_kpage);
+  } else {
+    // The page may have been read in by a process that has exited since, so it is written back through this process's file from now on
+    if (old_frame->file != NULL) {
+      set_frame_file(old_kpage, file, old_frame->file_ofs, old_frame->file_bytes, old_frame->file_writeback);
     }
+    pagedir_set_writable(t->pagedir, upage, true);
+  }
 
-    user_page->pd = child->pagedir;
-    user_page->uaddr = child_spt_page->upage;
-    user_page->frame_or_swap_slot_ptr = shared_frame;
-    user_page->used_in = FRAME;
+  old_frame->pinned = pinned;
+  // The processes the page was shared with may have exited while it was copied, leaving the old frame to this process alone
+  if (unused) {
+    free_frame(old_kpage);
+  }
+  return true;
+}
 
-    struct list *all_user_pages = get_all_user_pages();
-    struct lock *all_user_pages_lock = get_all_user_pages_lock();
+// Applies advice to pages from through to - 1 of range
+static void spt_range_advise (struct spt_range *range, size_t from, size_t to, int advice) {
+  uint32_t *pd = thread_current()->pagedir;
 
-    lock_acquire(all_user_pages_lock);
-    // Adds uer_page to all_user_pages. Useful for easy deallocation of user_page.
-    list_push_back(all_user_pages, &user_page->allelem);
-    lock_release(all_user_pages_lock);
+  switch (advice) {
+    case MADV_NORMAL:
+    case MADV_RANDOM:
+    case MADV_SEQUENTIAL:
+      range->advice = advice;
+      range->drop_idx = from;
+      break;
+    case MADV_WILLNEED:
+      for (size_t idx = from; idx < to; idx++) {
+        void *upage = range->upage + idx * PGSIZE;
+        struct user_page *user_page = lookup_user_page(pd, upage);
+
+        if (user_page != NULL && user_page->used_in == SWAP) {
+          pagedir_restore(pd, upage);
+        } else if (range->type != STACK && !spt_range_page_present(range, idx)) {
+          spt_range_load_page(range, idx, false);
+        }
+      }
+      break;
+    case MADV_DONTNEED:
+      for (size_t idx = from; idx < to; idx++) {
+        drop_page(pd, range->upage + idx * PGSIZE);
+      }
+      break;
+  }
+}
 
-    lock_acquire(&shared_frame->user_pages_lock);
-    list_push_back(&shared_frame->user_pages, &user_page->elem);
-    lock_release(&shared_frame->user_pages_lock);
+// Applies advice, one of the MADV_* values, to the length bytes of memory starting at addr. Returns false if advice is unknown or if any of the pages isn't in a range.
+// MADV_NORMAL, MADV_RANDOM and MADV_SEQUENTIAL change how the whole of each range is read ahead (see attempt_load_pages). MADV_WILLNEED reads the pages in now, and MADV_DONTNEED drops those that can be read back from their file (see drop_page).
+bool spt_advise (void *addr, size_t length, int advice) {
+  struct thread *t = thread_current();
+  struct spt *spt = &t->spt;
+  uint8_t *first = pg_round_down(addr);
+  uint8_t *last = pg_round_down((uint8_t *) addr + length - 1);
+
+  if (advice < MADV_NORMAL || advice > MADV_DONTNEED) {
+    return false;
+  }
+
+  lock_acquire(&spt->ranges_lock);
+
+  uint8_t *upage;
+  struct spt_range *range;
+  for (upage = first; upage <= last; upage = range->upage + range->page_cnt * PGSIZE) {
+    range = spt_find_range(spt, upage);
+    if (range == NULL) {
+      lock_release(&spt->ranges_lock);
+      return false;
+    }
+  }
+
+  for (upage = first; upage <= last; upage = range->upage + range->page_cnt * PGSIZE) {
+    range = spt_find_range(spt, upage);
+    size_t from = (upage - range->upage) / PGSIZE;
+    size_t to = (last - range->upage) / PGSIZE + 1;
+    if (to > range->page_cnt) {
+      to = range->page_cnt;
+    }
+    spt_range_advise(range, from, to, advice);
+  }
+
+  lock_release(&spt->ranges_lock);
+  return true;
+}
+
+// Breaks copy-on-write sharing of the pages holding object. Used before pinning a buffer the kernel writes to, so that the kernel never has to copy a pinned page.
+void unshare_obj (void *uaddr, int size) {
+  struct thread *t = thread_current();
+  void *first = pg_round_down(uaddr);
+  void *last = pg_round_down(uaddr + (size > 0 ? size - 1 : 0));
+
+  // Buffer hasn't been validated yet, so stop at the end of user memory
+  for (void *upage = first; upage <= last && is_user_vaddr(upage); upage += PGSIZE) {
+    if (pagedir_get_page(t->pagedir, upage) != NULL) {
+      copy_on_write(upage);
+    }
+  }
+}
+
+// Pins the frame upage is mapped to in pd. Returns false if upage isn't in a frame.
+// The mapping is checked again under the frame's lock, as evict holds it from choosing a victim until the victim's pages are cleared.
+static bool pin_page (uint32_t *pd, void *upage) {
+  void *kpage = pagedir_get_page(pd, upage);
+  struct frame *frame = kpage != NULL ? lookup_frame(kpage) : NULL;
+  if (frame == NULL) {
+    // The zero page isn't in the user pool, so it's never evicted
+    return kpage != NULL;
   }
 
-  lock_release(&spt_parent->pages_lock);
+  lock_acquire(&frame->user_pages_lock);
+  bool mapped = pagedir_get_page(pd, upage) == kpage;
+  if (mapped) {
+    frame->pinned = true;
+  }
+  lock_release(&frame->user_pages_lock);
+  return mapped;
 }
 
 // Pins frames holding object. Returns true if at least one page has been pinned, false otherwise. Used for user memory access in syscall handler.
+// Each page the object spans is read in first: from its file if it hasn't been loaded or was dropped by eviction, or from swap. A page evicted again before it's pinned is read in again.
 bool pin_obj (void *uaddr, int size) {
-  int size_cpy = size;
-  void *uaddr_cpy = uaddr;
-  // Loads pages into memory if they have not been loaded yet and if the object does NOT live in stack (we can't load stack from file)
-  for (size_cpy; size_cpy > 0; size_cpy -= PGSIZE) {
-    attempt_load_pages(uaddr_cpy);
-    uaddr_cpy += PGSIZE;
-  }
+  uint32_t *pd = thread_current()->pagedir;
+  bool success = false;
 
   ASSERT (is_user_vaddr(uaddr));
-  // Assuming the page is now either in frame or in swap, ensure it's in frame and pin this frame
-  bool success = pin_or_unpin_obj(uaddr, size, pin_frame);
+  void *first = pg_round_down(uaddr);
+  void *last = pg_round_down(uaddr + (size > 0 ? size - 1 : 0));
+
+  for (void *upage = first; upage <= last && is_user_vaddr(upage); upage += PGSIZE) {
+    // The kernel may write to the object, so zero-fill pages get their own frame
+    bool pinned = pin_page(pd, upage);
+    while (!pinned && (attempt_load_pages(upage, true) || pagedir_restore(pd, upage))) {
+      pinned = pin_page(pd, upage);
+    }
+    success = success || pinned;
+  }
   return success;
 }
 
@@ -220,26 +554,14 @@ bool unpin_obj (void *uaddr, int size) {
 // Helper function for pin_obj and unpin_obj
 static bool pin_or_unpin_obj (void *uaddr, int size, pin_or_unpin_frame *pin_or_unpin_frame) {
   struct thread *t = thread_current();
-  struct spt *spt = &t->spt;
-  struct list *pages = &spt->pages;
-
-  struct list_elem *e;
   bool success = false;
 
-  struct list *all_user_pages = get_all_user_pages();
-  struct lock *all_user_pages_lock = get_all_user_pages_lock();
-
-  lock_acquire(all_user_pages_lock);
+  // Visits only the pages the object spans, looking each one up in the reverse map
+  void *first = pg_round_down(uaddr);
+  void *last = pg_round_down(uaddr + (size > 0 ? size - 1 : 0));
 
-  for (e = list_begin (all_user_pages); e != list_end (all_user_pages); e = list_next (e)) {
-    struct user_page *user_page = list_entry (e, struct user_page, allelem);
-
-    // Checks if object belongs to user_page
-    bool contains_start = user_page->uaddr <= uaddr && uaddr < user_page->uaddr + PGSIZE;
-    bool contains_mid = uaddr < user_page->uaddr && user_page->uaddr < uaddr + size;
-    bool contains_end = user_page->uaddr <= uaddr + size && uaddr + size < user_page->uaddr + PGSIZE;
-
-    if (contains_start || contains_mid || contains_end) {
+  for (void *upage = first; upage <= last; upage += PGSIZE) {
+    if (lookup_user_page(t->pagedir, upage) != NULL) {
       struct frametable *frame_table = get_frame_table();
       
       // Need to acquire lock to make sure that frame is not evicted between the time that it's swapped in to RAM and the time that it's pinned.
@@ -247,32 +569,29 @@ static bool pin_or_unpin_obj (void *uaddr, int size, pin_or_unpin_frame *pin_or_
 
       // For pinning: if page in swap_slot, first swap it back in to a frame in RAM. Regardless whether page was in swap or already in frame, we get back the kernel address of the frame.
       // For unpinning it's assumed that the page is already in the frame in RAM since it's pinned. The frame cannot be removed during the syscall because the running process is one of its owners.
-      void *kpage = pagedir_get_page(t->pagedir, user_page->uaddr);
+      void *kpage = pagedir_get_page(t->pagedir, upage);
       success = pin_or_unpin_frame(kpage);
 
       lock_release(&frame_table->lock);
     }
   }
 
-  lock_release(all_user_pages_lock);
-
   return success;
 }
 
-// Frees spt_pages of process when process exits. Used in pagedir_destroy.
+// Frees spt_ranges of process when process exits. Used in process_exit.
 void free_process_spt (void) {
   struct thread *cur = thread_current();
   struct spt *spt = &cur->spt;
-  struct list *pages = &spt->pages;
+  struct list *ranges = &spt->ranges;
 
-  lock_acquire(&spt->pages_lock);
+  lock_acquire(&spt->ranges_lock);
 
-  while (!list_empty (pages)) {
-    struct list_elem *e = list_pop_front (pages);
-    struct spt_page *spt_page = list_entry(e, struct spt_page, elem);
-    free(spt_page);
+  while (!list_empty (ranges)) {
+    struct list_elem *e = list_pop_front (ranges);
+    struct spt_range *range = list_entry(e, struct spt_range, elem);
+    spt_range_destroy(range);
   }
 
-  lock_release(&spt->pages_lock);
+  lock_release(&spt->ranges_lock);
 }
-
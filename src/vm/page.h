@@ -12,6 +12,9 @@
 // In the spec it says that it should be: 0x08084000 but from the tests it seems like it's: 0x08048000
 #define EXE_BASE 0x08048000
 
+// Maximum number of pages read after a faulting page of a file or executable (see attempt_load_pages)
+#define FAULT_AROUND_MAX 16
+
 // Used in pinning
 typedef bool pin_or_unpin_frame (void *address);
 
@@ -29,46 +32,68 @@ struct spt {
   // Size of executable in memory
   uint32_t exe_size;
 
-  // List of all pages used by process (executable, file mappings).
-  // Note: could have used a hash map here for better time complexity of search but since SPT is per-process (as opposed to global), this data structure is not that big.
-  struct list pages;
-  // Lock on struct list pages. Needed for the time when child is already running and is copying pages from its parent. At the same time the parent might be running as well.
-  struct lock pages_lock;
+  // List of all ranges used by process (executable segments, file mappings, stack), sorted by start address.
+  // A process only has a handful of ranges, so a page fault walks this list instead of looking the page up in a per-page index.
+  struct list ranges;
+  // Lock on struct list ranges. Needed for the time when child is already running and is copying ranges from its parent. At the same time the parent might be running as well.
+  struct lock ranges_lock;
 };
 
-// Page (stack, executable or file)
-struct spt_page {
-  // Data type stored in page
+// Contiguous range of pages (stack, executable segment or file mapping). The state of each page is kept in a bitmap, so setting up a range costs the same however big it is.
+struct spt_range {
+  // Data type stored in range
   enum data_type type;
-  // Denotes whether page has been loaded into memory
-  bool loaded;
   // File to be loaded
   struct file *file;
-  // File name. Used for executable pages. Used in sharing to determine whether sharing of executable pages is necessary.
-  char *file_name;
 
   // Metadata passed in to load_segment
-  // Offset within executable file
+  // Offset within file of the first page
   off_t ofs;
-  // Page's virtual memory address
+  // Virtual memory address of the first page
   uint8_t *upage;
-  // Number of bytes to fill with data
+  // Number of pages in range
+  size_t page_cnt;
+  // Number of bytes to fill with data, starting at the first page. The rest of the range is filled with zeros.
   uint32_t read_bytes;
-  // Number of bytes to fill with zeros
-  uint32_t zero_bytes;
-  // Says whether segment can be written to. If false, segment is read-only. For files writable = true, for executable = false. Might become useful if we want to extend sharing with COW.
+  // Says whether range can be written to. If false, range is read-only. For files writable = true, for executable = false.
   bool writable;
 
+  // Bit i is set if page i has been loaded into memory. NULL for stack ranges, whose pages are never loaded from a file.
+  struct bitmap *loaded;
+
+  // Fault-around state
+  // Index of the page a sequential reader is expected to fault on next
+  size_t next_fault_idx;
+  // Number of pages read after the last faulting page. Doubles while faults are sequential, up to FAULT_AROUND_MAX.
+  size_t fault_around;
+  // Access pattern given by madvise, one of MADV_NORMAL, MADV_RANDOM or MADV_SEQUENTIAL
+  int advice;
+  // Under MADV_SEQUENTIAL, index of the first page that hasn't been dropped behind the reader
+  size_t drop_idx;
+
   // Elem for adding to spt
   struct list_elem elem;
 };
 
+struct spt_range *spt_range_create (enum data_type type, struct file *file, off_t ofs, void *upage, size_t page_cnt, uint32_t read_bytes, bool writable);
+void spt_range_destroy (struct spt_range *range);
+uint32_t spt_range_read_bytes (const struct spt_range *range, size_t idx);
+bool spt_range_page_present (struct spt_range *range, size_t idx);
+bool spt_range_load_page (struct spt_range *range, size_t idx, bool write);
+struct spt_range *spt_find_range (struct spt *spt, const void *uaddr);
+void spt_insert_range (struct spt *spt, struct spt_range *range);
 bool spt_contains_uaddr(void *upage);
+bool spt_overlaps (void *upage, size_t page_cnt);
 void spt_add_mmap_file(struct file *file, void *upage);
+struct file *spt_mmap_file (void *upage);
 bool spt_remove_mmap_file (void *upage);
-void spt_add_stack_page (void *upage);
+void spt_reserve_stack (void *upage);
+bool spt_advise (void *addr, size_t length, int advice);
 void share_pages (struct thread *parent, struct thread *child);
 
+bool copy_on_write (void *uaddr);
+void unshare_obj (void *uaddr, int size);
+
 bool pin_obj (void *uaddr, int size);
 bool unpin_obj (void *uaddr, int size);
 
@@ -4,6 +4,8 @@
 #include <bitmap.h>
 #include "vm/frame.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "userprog/pagedir.h"
 #include <stdbool.h>
 
 /*
@@ -16,6 +18,9 @@ static struct swap_table swap_table;
 // Lock on swap_table
 static struct lock swap_table_lock;
 
+static void swap_in (struct swap_slot *swap_slot, void *kpage);
+static void read_ahead (uint32_t *pd, size_t slot);
+
 unsigned 
 swap_hash(const struct hash_elem *e, void *aux UNUSED)
 {
@@ -35,40 +40,57 @@ static void swap_destroy (struct hash_elem *e, void *aux) {
 
 void init_swap_table(void){
   swap_table.swap_block = block_get_role(BLOCK_SWAP);
-  swap_table.bitmap = bitmap_create(4096);
+  size_t slot_cnt = swap_table.swap_block != NULL ? block_size(swap_table.swap_block) / SECTORS_PER_PAGE : 0;
+  swap_table.bitmap = bitmap_create(slot_cnt);
+  swap_table.slots = calloc(slot_cnt, sizeof *swap_table.slots);
+  if (swap_table.bitmap == NULL || (slot_cnt > 0 && swap_table.slots == NULL)) {
+    PANIC ("Swap table allocation failed");
+  }
+  swap_table.next_slot = 0;
   hash_init(&swap_table.table, swap_hash, swap_less, NULL);
   lock_init(&swap_table.lock);
   lock_init(&swap_table_lock);
 }
 
-// Writes data from frame to swap slot. Mallocs a swap slot in the process.
-// could be void
-/* Must already hold frame's user pages lock */
-bool 
-write_swap_slot(struct frame* frame)
+// Reserves cnt consecutive free slots, searching from where the last search stopped. Returns the first slot, or BITMAP_ERROR if there is no such run.
+static size_t
+allocate_slots (size_t cnt)
 {
-  // Sets bits to 0
-  size_t start = bitmap_scan_and_flip(swap_table.bitmap, 0, frame -> size * SECTORS_PER_PAGE, 0);
+  lock_acquire(&swap_table.lock);
 
-  if (start == BITMAP_ERROR) {
-    PANIC("Failed to find available swap slot");
+  size_t slot = bitmap_scan_and_flip(swap_table.bitmap, swap_table.next_slot, cnt, false);
+  if (slot == BITMAP_ERROR) {
+    slot = bitmap_scan_and_flip(swap_table.bitmap, 0, cnt, false);
   }
+  if (slot != BITMAP_ERROR) {
+    swap_table.next_slot = slot + cnt;
+  }
+
+  lock_release(&swap_table.lock);
+  return slot;
+}
 
+// Writes data from frame to the given slot. Mallocs a swap slot in the process.
+/* Must already hold frame's user pages lock */
+static void
+write_swap_slot (struct frame *frame, size_t slot)
+{
   struct swap_slot *swap_slot = malloc(sizeof(struct swap_slot));
   if (swap_slot == NULL) {
     PANIC ("Swap slot allocation failed");
   }
 
-  // Copies contents of frame to swap_slot
-  for (int i = 0; i < frame -> size * SECTORS_PER_PAGE; i++) {
-    ASSERT (swap_table.swap_block);
-    block_write(swap_table.swap_block, start + i, frame -> address + (i * BLOCK_SECTOR_SIZE));
-  }
-
+  swap_slot -> sector = slot * SECTORS_PER_PAGE;
   swap_slot -> size = frame -> size * SECTORS_PER_PAGE;
   list_init(&swap_slot->user_pages);
   lock_init(&swap_slot->lock);
 
+  // Copies contents of frame to swap_slot
+  for (int i = 0; i < swap_slot -> size; i++) {
+    ASSERT (swap_table.swap_block);
+    block_write(swap_table.swap_block, swap_slot -> sector + i, frame -> address + (i * BLOCK_SECTOR_SIZE));
+  }
+
   lock_acquire(&swap_slot->lock);
 
   // Moves user_pages from frame to swap slot preserving ordering
@@ -82,29 +104,65 @@ write_swap_slot(struct frame* frame)
 
   lock_release(&swap_slot->lock);
 
+  lock_acquire(&swap_table.lock);
+  swap_table.slots[slot] = swap_slot;
   hash_insert(&swap_table.table, &swap_slot->elem);
-  return true;
+  lock_release(&swap_table.lock);
+}
+
+// Writes the data of cnt frames to swap, in one run of consecutive slots if there is one, so the disk writes them in a single sequential pass. Falls back to shorter runs when swap is fragmented.
+/* Must already hold the frames' user pages locks */
+void 
+write_swap_cluster (struct frame **frames, size_t cnt)
+{
+  size_t done = 0;
+
+  while (done < cnt) {
+    size_t run = cnt - done;
+    size_t slot;
+
+    while ((slot = allocate_slots(run)) == BITMAP_ERROR) {
+      if (run == 1) {
+        PANIC("Failed to find available swap slot");
+      }
+      run /= 2;
+    }
+
+    for (size_t i = 0; i < run; i++) {
+      write_swap_slot(frames[done + i], slot + i);
+    }
+    done += run;
+  }
 }
 
-// Writes data from swap slot to frame
-// could be void
-bool read_swap_slot(uint32_t *pd, void* vaddr, void* kpage){ //*frame instead?
-  // For now works only for non-shared pages
-  struct swap_slot *swap_slot = lookup_swap_slot(vaddr, pd);
+// Writes data from swap slot to frame, and reads ahead the process's pages in the slots that follow
+// Returns false if the page isn't in swap, which happens if a process sharing it has read it back in since it was looked up.
+bool read_swap_slot(uint32_t *pd, void* vaddr, void* kpage){
+  struct swap_slot *swap_slot = lock_swap_slot(pd, vaddr);
   if (swap_slot == NULL)
   {
     return false;
   }
+
+  size_t slot = swap_slot -> sector / SECTORS_PER_PAGE;
+  swap_in(swap_slot, kpage);
+  read_ahead(pd, slot);
+  return true;
+}
+
+// Reads swap_slot into the frame at kpage, moves its user_pages to the frame and frees the slot
+/* Must already hold swap_slot's lock, which is released */
+static void
+swap_in (struct swap_slot *swap_slot, void *kpage)
+{
   // Copies data from swap_slot to frame
   for (int i = 0; i < swap_slot -> size; i++){
-    block_write(swap_table.swap_block, swap_slot -> sector + i, kpage + (i* BLOCK_SECTOR_SIZE));
+    block_read(swap_table.swap_block, swap_slot -> sector + i, kpage + (i* BLOCK_SECTOR_SIZE));
   }
-  block_write(swap_table.swap_block, swap_slot -> sector, kpage);
  
   struct frame *frame = lookup_frame(kpage);
   ASSERT (frame != NULL);
 
-  lock_acquire(&swap_slot->lock);
   lock_acquire(&frame->user_pages_lock);
 
   // Moves user_pages from swap_slot to frame
@@ -118,34 +176,83 @@ bool read_swap_slot(uint32_t *pd, void* vaddr, void* kpage){ //*frame instead?
 
   lock_release(&frame->user_pages_lock);
   lock_release(&swap_slot->lock);
-  
 
-  //delete_swap_slot(swap_slot);
+  delete_swap_slot(swap_slot);
 }
 
-// Helper function. Used in read_swap_slot and when process exits to delete swap_slots where the process's data is (unless swap_slot has data from frame that is shared and other processes with access are still alive).
-void delete_swap_slot (struct swap_slot *swap_slot) {
-  bitmap_set_multiple(swap_table.bitmap, swap_slot -> sector, swap_slot -> size, 0); //swap slot sector gets corrupted before here
-  hash_delete(&swap_table.table, &swap_slot -> elem);
-  free(swap_slot);
+// Returns the address at which pd maps the page held in swap_slot, or NULL if it doesn't
+static void *
+slot_uaddr (struct swap_slot *swap_slot, uint32_t *pd)
+{
+  struct list_elem *e;
+  void *uaddr = NULL;
+
+  lock_acquire(&swap_slot->lock);
+  for (e = list_begin (&swap_slot->user_pages); e != list_end (&swap_slot->user_pages); e = list_next (e)) {
+    struct user_page *user_page = list_entry(e, struct user_page, elem);
+    if (user_page->pd == pd) {
+      uaddr = user_page->uaddr;
+      break;
+    }
+  }
+  lock_release(&swap_slot->lock);
+  return uaddr;
 }
 
-// Gets swap_slot that upage interpreted under pd points to
-struct swap_slot *lookup_swap_slot (void *upage, void *pd) {
-  struct list *all_user_pages = get_all_user_pages();
-  struct list_elem *e;
+// Pages evicted together are likely to be used together, so after a fault the process's pages in the following slots are read in too.
+// Read-ahead only uses free frames and stops at the first slot that doesn't hold one of the process's pages.
+static void
+read_ahead (uint32_t *pd, size_t slot)
+{
+  size_t slot_cnt = bitmap_size(swap_table.bitmap);
 
-  for (e = list_begin (all_user_pages); e != list_end (all_user_pages); e = list_next (e)) {
+  for (size_t i = slot + 1; i < slot + SWAP_READ_AHEAD && i < slot_cnt; i++) {
+    lock_acquire(&swap_table.lock);
+    struct swap_slot *swap_slot = swap_table.slots[i];
+    void *uaddr = swap_slot != NULL ? slot_uaddr(swap_slot, pd) : NULL;
+    lock_release(&swap_table.lock);
 
-    struct user_page *user_page = list_entry (e, struct user_page, allelem);
-    if (user_page->pd == pd && user_page->uaddr == upage && user_page->used_in == SWAP) {
+    if (uaddr == NULL) {
+      break;
+    }
+
+    // palloc_get_page doesn't evict, unlike palloc_get_page_aux
+    void *kpage = palloc_get_page(PAL_USER);
+    if (kpage == NULL) {
+      break;
+    }
+    // The page already has a user_page, which swap_in moves to the frame
+    frame_insert(kpage, pd, uaddr, 1);
 
-      struct swap_slot *swap_slot = user_page->frame_or_swap_slot_ptr;
-      return swap_slot;
+    // The slot is looked up again and kept locked until it has been read, as a process sharing it may have read it in or freed it in the meantime
+    swap_slot = lock_swap_slot(pd, uaddr);
+    if (swap_slot == NULL) {
+      unpin_frame(kpage);
+      palloc_free_page(kpage);
+      break;
     }
+    swap_in(swap_slot, kpage);
+    pagedir_remap(pd, uaddr, kpage);
+    unpin_frame(kpage);
   }
+}
+
+// Helper function. Used in read_swap_slot and when process exits to delete swap_slots where the process's data is (unless swap_slot has data from frame that is shared and other processes with access are still alive).
+// Must be called with none of the slot's user_pages left in it.
+void delete_swap_slot (struct swap_slot *swap_slot) {
+  size_t slot = swap_slot -> sector / SECTORS_PER_PAGE;
+  // Waits for lock_swap_slot calls that may be about to lock the slot (see lock_swap_slot)
+  struct lock *user_page_map_lock = get_user_page_map_lock();
 
-  return NULL;
+  lock_acquire(user_page_map_lock);
+  lock_acquire(&swap_table.lock);
+  bitmap_reset(swap_table.bitmap, slot);
+  swap_table.slots[slot] = NULL;
+  hash_delete(&swap_table.table, &swap_slot -> elem);
+  lock_release(&swap_table.lock);
+  lock_release(user_page_map_lock);
+
+  free(swap_slot);
 }
 
 // Called at OS termination
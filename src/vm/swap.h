@@ -8,6 +8,11 @@
 
 #define SECTORS_PER_PAGE 8
 
+// Maximum number of pages evicted and written to swap together
+#define SWAP_CLUSTER 8
+// Maximum number of pages read in from swap on a fault, including the one faulted on
+#define SWAP_READ_AHEAD 4
+
 struct swap_slot{
   block_sector_t sector;  //value
   int size;               //size in sectors
@@ -23,18 +28,22 @@ struct swap_slot{
 //need not be a struct
 struct swap_table{
   struct block *swap_block; 
-  struct bitmap *bitmap; //bitmap to determine free sectors in block
+  struct bitmap *bitmap; //bitmap to determine free page-sized slots in block
   struct hash table;  //swap table recording swap slots for reading and writing
 
-  // Lock on hash table
+  // Swap slot held in each page-sized slot of block, or NULL. Used to find the neighbours of a slot for read-ahead.
+  struct swap_slot **slots;
+  // Slot to start searching for free slots from, so that consecutive evictions get consecutive slots
+  size_t next_slot;
+
+  // Lock on bitmap, slots and next_slot
   struct lock lock;
 };
 
 void init_swap_table(void);
 bool read_swap_slot(uint32_t *pd, void* vadrr, void* kpage);
-bool write_swap_slot(struct frame* frame);
+void write_swap_cluster (struct frame **frames, size_t cnt);
 void delete_swap_slot (struct swap_slot *swap_slot);
-struct swap_slot *lookup_swap_slot (void *upage, void *pd);
 void remove_all_swap_slots (void);
 struct swap_table *get_swap_table (void);
 struct lock *get_swap_table_lock (void);